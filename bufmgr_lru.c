@@ -160,6 +160,27 @@ int			checkpoint_flush_after = DEFAULT_CHECKPOINT_FLUSH_AFTER;
 int			bgwriter_flush_after = DEFAULT_BGWRITER_FLUSH_AFTER;
 int			backend_flush_after = DEFAULT_BACKEND_FLUSH_AFTER;
 
+/*
+ * cs3223 - whether BgBufferSync runs the background writer's LRU scan.
+ *
+ * The scan writes out dirty buffers just ahead of the clock sweep hand
+ * (StrategySyncStart), so that backends find clean victims there.  Only
+ * the clock sweep of the stock freelist.c moves that hand, so the scan is
+ * off by default, and then the background writer does no cleaning at all
+ * and simply hibernates: every dirty buffer is written either by the
+ * backend that evicts it or by a checkpoint, and recent allocations are
+ * not reported to pgstat.  freelist_multi.c turns it on when "clock" is
+ * chosen.
+ */
+bool		bgwriter_lru_scan = false;
+
+/*
+ * cs3223 - called with the buf_id of a buffer that has lost its last pin.
+ * Optional: a replacement policy that needs it sets it in
+ * StrategyInitialize, the others leave it NULL.
+ */
+void		(*StrategyUnpinBuffer_hook) (int buf_id) = NULL;
+
 /* local state for LockBufferForCleanup */
 static BufferDesc *PinCountWaitBuf = NULL;
 
@@ -206,6 +227,7 @@ static inline int32 GetPrivateRefCount(Buffer buffer);
 static void ForgetPrivateRefCountEntry(PrivateRefCountEntry *ref);
 
 extern void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+extern void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
 
 /*
  * Ensure that the PrivateRefCountArray has sufficient space to store one more
@@ -488,7 +510,8 @@ static BufferDesc *BufferAlloc(SMgrRelation smgr,
 							   BlockNumber blockNum,
 							   BufferAccessStrategy strategy,
 							   bool *foundPtr, IOContext io_context);
-static Buffer GetVictimBuffer(BufferAccessStrategy strategy, IOContext io_context);
+static Buffer GetVictimBuffer(BufferAccessStrategy strategy, IOContext io_context,
+							  const BufferTag *tag); /* cs3223 */
 static void FlushBuffer(BufferDesc *buf, SMgrRelation reln,
 						IOObject io_object, IOContext io_context);
 static void FindAndDropRelationBuffers(RelFileLocator rlocator,
@@ -1294,7 +1317,7 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 	 * don't hold any conflicting locks. If so we'll have to undo our work
 	 * later.
 	 */
-	victim_buffer = GetVictimBuffer(strategy, io_context);
+	victim_buffer = GetVictimBuffer(strategy, io_context, &newTag); /* cs3223 */
 	victim_buf_hdr = GetBufferDescriptor(victim_buffer - 1);
 
 	/*
@@ -1583,8 +1606,15 @@ InvalidateVictimBuffer(BufferDesc *buf_hdr)
 	return true;
 }
 
+/*
+ * cs3223: tag is the page the victim buffer is for, or NULL when extending a
+ * relation.  It is handed to the replacement policy right before every
+ * StrategyGetBuffer call, including the retries below, so a tag left behind
+ * by a call that errored out is replaced before any later call can see it.
+ */
 static Buffer
-GetVictimBuffer(BufferAccessStrategy strategy, IOContext io_context)
+GetVictimBuffer(BufferAccessStrategy strategy, IOContext io_context,
+				const BufferTag *tag)
 {
 	BufferDesc *buf_hdr;
 	Buffer		buf;
@@ -1605,7 +1635,9 @@ again:
 	 * Select a victim buffer.  The buffer is returned with its header
 	 * spinlock still held!
 	 */
+	StrategySetIncomingTag(tag); /* cs3223 */
 	buf_hdr = StrategyGetBuffer(strategy, &buf_state, &from_ring);
+	StrategySetIncomingTag(NULL); /* cs3223 */
 	buf = BufferDescriptorGetBuffer(buf_hdr);
 
 	Assert(BUF_STATE_GET_REFCOUNT(buf_state) == 0);
@@ -1854,7 +1886,7 @@ ExtendBufferedRelShared(BufferManagerRelation bmr,
 	{
 		Block		buf_block;
 
-		buffers[i] = GetVictimBuffer(strategy, io_context);
+		buffers[i] = GetVictimBuffer(strategy, io_context, NULL); /* cs3223 */
 		buf_block = BufHdrGetBlock(GetBufferDescriptor(buffers[i] - 1));
 
 		/* new buffers are zero-filled */
@@ -2431,6 +2463,10 @@ UnpinBuffer(BufferDesc *buf)
 				break;
 		}
 
+		if (BUF_STATE_GET_REFCOUNT(buf_state) == 0 &&
+			StrategyUnpinBuffer_hook != NULL)
+			StrategyUnpinBuffer_hook(buf->buf_id); /* cs3223 */
+
 		/* Support LockBufferForCleanup() */
 		if (buf_state & BM_PIN_COUNT_WAITER)
 		{
@@ -2800,7 +2836,9 @@ BgBufferSync(WritebackContext *wb_context)
 	long		new_strategy_delta;
 	uint32		new_recent_alloc;
 
-	return true;   /* cs3223 - hibernate the background writer process */
+	/* cs3223 - without the LRU scan there is nothing to do, see bgwriter_lru_scan */
+	if (!bgwriter_lru_scan)
+		return true;   /* cs3223 - hibernate the background writer process */
 
 	/*
 	 * Find out where the freelist clock sweep currently is, and how many
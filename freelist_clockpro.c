@@ -0,0 +1,1330 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * CLOCK-Pro (Jiang, Chen and Zhang) approximates LIRS with clocks, so that,
+ * as with the original clock sweep, a hit only sets a reference bit.  Hot
+ * pages play the role of LIR pages and cold pages that of HIR pages.  All
+ * pages sit on a single circular list, the clock, in the order they were
+ * added:
+ *
+ *	hot			 - resident pages with a short reuse distance.
+ *	cold		 - resident pages in their test period; only these are
+ *				   evicted.
+ *	non-resident - tags of cold pages that were evicted during their test
+ *				   period, remembered in ghost entries.
+ *
+ * The reference bit is the buffer's usage_count, which PinBuffer() already
+ * bumps atomically on every hit: bufmgr sets it to 1 when a page is read in,
+ * so a buffer counts as referenced when its usage_count is above 1, and the
+ * hands clear the bit by setting it back to 1.  StrategyAccessBuffer() has
+ * nothing to do on a hit and takes no lock.
+ *
+ * Three hands move around the clock:
+ *
+ *	HAND_cold - evicts the first unreferenced cold page it meets.  A cold
+ *				page found referenced has proven a short reuse distance and
+ *				turns hot.
+ *	HAND_hot  - keeps the hot pages within their share of the buffers by
+ *				demoting the first unreferenced hot page it meets to cold,
+ *				clearing reference bits on the way.
+ *	HAND_test - ends the test period of non-resident pages by forgetting
+ *				them, which keeps their number within NBuffers.
+ *
+ * A page read in while it is still remembered as non-resident turns hot at
+ * once, and grows coldTarget, the share of the buffers given to cold pages,
+ * as a larger share would have kept it resident.  A test period that ends
+ * without such a reference shrinks it again.  New pages are added right
+ * behind HAND_hot, so that all hands reach them last.
+ *
+ * Nodes are linked by int32 index into clockproNodes[], like the LRU stack
+ * in freelist_lru.c: entries 0 .. NBuffers - 1 belong to the buffers and
+ * entries NBuffers .. 2 * NBuffers - 1 are ghost entries.  The clock needs
+ * no sentinel, a hand is CLOCKPRO_NODE_NOT_IN_LIST while the clock is empty.
+ */
+typedef struct ClockProNode
+{
+	int32		prev;
+	int32		next;
+	int			status;			/* CLOCKPRO_STATUS_xxx */
+} ClockProNode;
+
+#define CLOCKPRO_NODE_NOT_IN_LIST	(-1)
+
+#define CLOCKPRO_STATUS_NONE		0	/* buffer not in use, or unused ghost */
+#define CLOCKPRO_STATUS_HOT			1
+#define CLOCKPRO_STATUS_COLD		2
+#define CLOCKPRO_STATUS_NONRESIDENT	3	/* ghost entry in its test period */
+
+#define ClockProGhostNode(ghost)	(NBuffers + (ghost))
+#define ClockProNodeGhost(node)	((node) - NBuffers)
+
+#define CLOCKPRO_NODES		(2 * NBuffers)
+
+/*
+ * A ghost entry holds the tag of a non-resident cold page.  Ghost entries
+ * are found by tag through a chained hash table, clockproGhostBuckets[];
+ * hashNext also links the unused entries together.
+ */
+typedef struct ClockProGhost
+{
+	BufferTag	tag;
+	int32		hashNext;
+} ClockProGhost;
+
+#define CLOCKPRO_GHOST_NONE	(-1)
+
+static ClockProNode *clockproNodes = NULL;
+static ClockProGhost *clockproGhosts = NULL;
+static int32 *clockproGhostBuckets = NULL;
+
+/*
+ * Tag of the page bufmgr is about to read in, see StrategySetIncomingTag.
+ * Backend-private.
+ */
+static BufferTag clockproIncomingTag;
+static bool clockproHaveIncomingTag = false;
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects the clock, the ghost entries and the fields below.
+	 * When a buffer header spinlock is needed as well, clockpro_lock is
+	 * always taken first.
+	 */
+	slock_t		clockpro_lock;
+
+	int32		handHot;		/* nodes under the three hands */
+	int32		handCold;
+	int32		handTest;
+	int			countHot;		/* number of nodes of each status */
+	int			countCold;
+	int			countNonResident;
+	int			coldTarget;		/* adaptive share of cold pages, 1 .. NBuffers - 1 */
+	int32		firstFreeGhost; /* head of list of unused ghost entries */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+/*
+ * ClockProAddNode -- add node to the clock right behind HAND_hot, with the
+ *		given status.
+ *
+ * Caller must hold clockpro_lock, and the node must not be on the clock.
+ */
+static void
+ClockProAddNode(int32 node, int status)
+{
+	ClockProNode *curr = &clockproNodes[node];
+	int32		hand = StrategyControl->handHot;
+
+	if (hand == CLOCKPRO_NODE_NOT_IN_LIST)
+	{
+		curr->prev = node;
+		curr->next = node;
+		StrategyControl->handHot = node;
+		StrategyControl->handCold = node;
+		StrategyControl->handTest = node;
+	}
+	else
+	{
+		curr->next = hand;
+		curr->prev = clockproNodes[hand].prev;
+		clockproNodes[curr->prev].next = node;
+		clockproNodes[hand].prev = node;
+	}
+
+	curr->status = status;
+	if (status == CLOCKPRO_STATUS_HOT)
+		StrategyControl->countHot++;
+	else if (status == CLOCKPRO_STATUS_COLD)
+		StrategyControl->countCold++;
+	else
+		StrategyControl->countNonResident++;
+}
+
+/*
+ * ClockProRemoveNode -- take node off the clock, if it is on it.  A hand
+ *		pointing at it moves back one node, so that its next step takes it to
+ *		the node that followed.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static void
+ClockProRemoveNode(int32 node)
+{
+	ClockProNode *curr = &clockproNodes[node];
+
+	if (curr->status == CLOCKPRO_STATUS_NONE)
+		return;
+
+	if (curr->next == node)
+	{
+		StrategyControl->handHot = CLOCKPRO_NODE_NOT_IN_LIST;
+		StrategyControl->handCold = CLOCKPRO_NODE_NOT_IN_LIST;
+		StrategyControl->handTest = CLOCKPRO_NODE_NOT_IN_LIST;
+	}
+	else
+	{
+		if (StrategyControl->handHot == node)
+			StrategyControl->handHot = curr->prev;
+		if (StrategyControl->handCold == node)
+			StrategyControl->handCold = curr->prev;
+		if (StrategyControl->handTest == node)
+			StrategyControl->handTest = curr->prev;
+
+		clockproNodes[curr->prev].next = curr->next;
+		clockproNodes[curr->next].prev = curr->prev;
+	}
+
+	if (curr->status == CLOCKPRO_STATUS_HOT)
+		StrategyControl->countHot--;
+	else if (curr->status == CLOCKPRO_STATUS_COLD)
+		StrategyControl->countCold--;
+	else
+		StrategyControl->countNonResident--;
+
+	curr->prev = CLOCKPRO_NODE_NOT_IN_LIST;
+	curr->next = CLOCKPRO_NODE_NOT_IN_LIST;
+	curr->status = CLOCKPRO_STATUS_NONE;
+}
+
+static inline int32 *
+ClockProGhostBucket(BufferTag *tag)
+{
+	return &clockproGhostBuckets[BufTableHashCode(tag) % NBuffers];
+}
+
+/*
+ * ClockProGhostLookup -- return the ghost entry remembering tag, or
+ *		CLOCKPRO_GHOST_NONE.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static int32
+ClockProGhostLookup(BufferTag *tag)
+{
+	int32		ghost;
+
+	for (ghost = *ClockProGhostBucket(tag);
+		 ghost != CLOCKPRO_GHOST_NONE;
+		 ghost = clockproGhosts[ghost].hashNext)
+	{
+		if (BufferTagsEqual(&clockproGhosts[ghost].tag, tag))
+			return ghost;
+	}
+
+	return CLOCKPRO_GHOST_NONE;
+}
+
+/*
+ * ClockProGhostForget -- take a ghost entry off the clock and out of the
+ *		hash table, and make it available for reuse.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static void
+ClockProGhostForget(int32 ghost)
+{
+	int32	   *link = ClockProGhostBucket(&clockproGhosts[ghost].tag);
+
+	while (*link != ghost)
+		link = &clockproGhosts[*link].hashNext;
+	*link = clockproGhosts[ghost].hashNext;
+
+	ClockProRemoveNode(ClockProGhostNode(ghost));
+
+	clockproGhosts[ghost].hashNext = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = ghost;
+}
+
+/*
+ * ClockProTestReference -- return whether the page in buffer has been
+ *		referenced since the bit was last cleared, and clear it.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static bool
+ClockProTestReference(int buf_id)
+{
+	BufferDesc *buf = GetBufferDescriptor(buf_id);
+	uint32		local_buf_state = LockBufHdr(buf);
+	bool		referenced = BUF_STATE_GET_USAGECOUNT(local_buf_state) > 1;
+
+	if (referenced)
+	{
+		local_buf_state &= ~BUF_USAGECOUNT_MASK;
+		local_buf_state += BUF_USAGECOUNT_ONE;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	return referenced;
+}
+
+/*
+ * ClockProRunHandTest -- move HAND_test one step, ending the test period of
+ *		the non-resident page under it, if any.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static void
+ClockProRunHandTest(void)
+{
+	int32		node = StrategyControl->handTest;
+
+	if (node == CLOCKPRO_NODE_NOT_IN_LIST)
+		return;
+
+	if (clockproNodes[node].status == CLOCKPRO_STATUS_NONRESIDENT)
+	{
+		// not reused within its test period, so the cold share was large enough
+		ClockProGhostForget(ClockProNodeGhost(node));
+		StrategyControl->coldTarget = Max(StrategyControl->coldTarget - 1, 1);
+		if (StrategyControl->handTest == CLOCKPRO_NODE_NOT_IN_LIST)
+			return;
+	}
+
+	StrategyControl->handTest = clockproNodes[StrategyControl->handTest].next;
+}
+
+/*
+ * ClockProRunHandHot -- move HAND_hot one step.  An unreferenced hot page
+ *		under it is demoted to cold, a referenced one loses its reference.
+ *		HAND_hot pushes HAND_test along when it catches up with it.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static void
+ClockProRunHandHot(void)
+{
+	int32		node;
+
+	if (StrategyControl->handHot == StrategyControl->handTest)
+		ClockProRunHandTest();
+
+	node = StrategyControl->handHot;
+	if (node == CLOCKPRO_NODE_NOT_IN_LIST)
+		return;
+
+	if (clockproNodes[node].status == CLOCKPRO_STATUS_HOT &&
+		!ClockProTestReference(node))
+	{
+		clockproNodes[node].status = CLOCKPRO_STATUS_COLD;
+		StrategyControl->countHot--;
+		StrategyControl->countCold++;
+	}
+
+	StrategyControl->handHot = clockproNodes[node].next;
+}
+
+/*
+ * ClockProBalance -- run HAND_hot until the hot pages are within their share
+ *		of the buffers.  Two revolutions at most, as the first one clears
+ *		every reference bit.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static void
+ClockProBalance(void)
+{
+	while (StrategyControl->countHot > NBuffers - StrategyControl->coldTarget)
+		ClockProRunHandHot();
+}
+
+/*
+ * ClockProAdapt -- look the incoming page up among the non-resident pages.
+ *
+ * A page found there is reused within its test period: the cold share grows
+ * and the ghost entry is forgotten, as the page is about to become resident
+ * again.  Returns whether the page was found.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static bool
+ClockProAdapt(void)
+{
+	int32		ghost;
+
+	if (!clockproHaveIncomingTag)
+		return false;
+
+	ghost = ClockProGhostLookup(&clockproIncomingTag);
+	if (ghost == CLOCKPRO_GHOST_NONE)
+		return false;
+
+	StrategyControl->coldTarget = Min(StrategyControl->coldTarget + 1, NBuffers - 1);
+	ClockProGhostForget(ghost);
+	return true;
+}
+
+/*
+ * ClockProLoadBuffer -- note that buffer is about to be (re)loaded with the
+ *		incoming page.
+ *
+ * A cold page previously held in the buffer stays on the clock, in the same
+ * place, as a non-resident page; a hot one is simply dropped.  The buffer is
+ * then added behind HAND_hot, hot if the incoming page was found among the
+ * non-resident pages and cold otherwise.  The caller holds the buffer header
+ * spinlock, so buf->tag and buf_state still describe the previous page.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static void
+ClockProLoadBuffer(BufferDesc *buf, uint32 buf_state, bool ghost_hit)
+{
+	int			buf_id = buf->buf_id;
+
+	if (clockproNodes[buf_id].status == CLOCKPRO_STATUS_COLD &&
+		(buf_state & BM_TAG_VALID))
+	{
+		int32		ghost;
+		int32		node;
+		int32	   *bucket;
+
+		// NBuffers non-resident pages at most, HAND_test makes room if needed
+		while (StrategyControl->firstFreeGhost == CLOCKPRO_GHOST_NONE)
+			ClockProRunHandTest();
+
+		ghost = StrategyControl->firstFreeGhost;
+		StrategyControl->firstFreeGhost = clockproGhosts[ghost].hashNext;
+
+		bucket = ClockProGhostBucket(&buf->tag);
+		clockproGhosts[ghost].tag = buf->tag;
+		clockproGhosts[ghost].hashNext = *bucket;
+		*bucket = ghost;
+
+		// link the ghost entry in right after the buffer, then drop the buffer
+		node = ClockProGhostNode(ghost);
+		clockproNodes[node].prev = buf_id;
+		clockproNodes[node].next = clockproNodes[buf_id].next;
+		clockproNodes[clockproNodes[node].next].prev = node;
+		clockproNodes[buf_id].next = node;
+		clockproNodes[node].status = CLOCKPRO_STATUS_NONRESIDENT;
+		StrategyControl->countNonResident++;
+	}
+
+	ClockProRemoveNode(buf_id);
+
+	if (ghost_hit)
+	{
+		// make room first, HAND_hot must not reach the buffer we hold locked
+		while (StrategyControl->countHot >= NBuffers - StrategyControl->coldTarget)
+			ClockProRunHandHot();
+		ClockProAddNode(buf_id, CLOCKPRO_STATUS_HOT);
+	}
+	else
+		ClockProAddNode(buf_id, CLOCKPRO_STATUS_COLD);
+}
+
+/*
+ * ClockProGetVictim -- run HAND_cold until an unreferenced, unpinned cold
+ *		page is under it, and return its buffer with the header spinlock
+ *		held, or NULL if every buffer is pinned.
+ *
+ * If a whole revolution finds no such page, every cold page is pinned, and
+ * HAND_hot is run until it demotes a hot page.  Once there is no hot page
+ * left to demote, every buffer is pinned.
+ *
+ * Caller must hold clockpro_lock.
+ */
+static BufferDesc *
+ClockProGetVictim(uint32 *buf_state)
+{
+	int			steps = 0;
+
+	for (;;)
+	{
+		int32		node = StrategyControl->handCold;
+
+		if (node == CLOCKPRO_NODE_NOT_IN_LIST)
+			return NULL;
+
+		if (clockproNodes[node].status == CLOCKPRO_STATUS_COLD)
+		{
+			BufferDesc *buf = GetBufferDescriptor(node);
+			uint32		local_buf_state = LockBufHdr(buf);
+
+			if (BUF_STATE_GET_USAGECOUNT(local_buf_state) > 1)
+			{
+				// referenced in its test period: turn hot
+				local_buf_state &= ~BUF_USAGECOUNT_MASK;
+				local_buf_state += BUF_USAGECOUNT_ONE;
+				UnlockBufHdr(buf, local_buf_state);
+
+				clockproNodes[node].status = CLOCKPRO_STATUS_HOT;
+				StrategyControl->countCold--;
+				StrategyControl->countHot++;
+				ClockProBalance();
+				steps = 0;
+			}
+			else if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				StrategyControl->handCold = clockproNodes[node].next;
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			else
+				UnlockBufHdr(buf, local_buf_state);
+		}
+
+		StrategyControl->handCold = clockproNodes[StrategyControl->handCold].next;
+
+		if (++steps > StrategyControl->countHot + StrategyControl->countCold +
+			StrategyControl->countNonResident)
+		{
+			int			cold = StrategyControl->countCold;
+
+			if (StrategyControl->countHot == 0)
+				return NULL;
+			while (StrategyControl->countCold == cold)
+				ClockProRunHandHot();
+			steps = 0;
+		}
+	}
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The tag is looked up among the non-resident pages.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	clockproHaveIncomingTag = (tag != NULL);
+	if (tag != NULL)
+		clockproIncomingTag = *tag;
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Does nothing if delete is false, as PinBuffer has already set the reference bit (usage_count);
+// otherwise, delete buffer buf_id from the clock.  A dropped page is not remembered as non-resident.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	if (!delete)
+		return;
+
+	SpinLockAcquire(&StrategyControl->clockpro_lock);
+	ClockProRemoveNode(buf_id);
+	SpinLockRelease(&StrategyControl->clockpro_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  clockpro_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be reloaded while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->clockpro_lock);
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			ClockProLoadBuffer(buf, *buf_state, ClockProAdapt());
+			SpinLockRelease(&StrategyControl->clockpro_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->clockpro_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For clockpro implementation, usage_count is the reference bit and
+			 * does not matter for a free buffer.
+			 */
+			SpinLockAcquire(&StrategyControl->clockpro_lock);
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				ClockProLoadBuffer(buf, local_buf_state, ClockProAdapt());
+				SpinLockRelease(&StrategyControl->clockpro_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->clockpro_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run CLOCK-Pro: adapt the cold share to a
+	 * reused non-resident page first, then run HAND_cold for a victim.
+	 */
+	SpinLockAcquire(&StrategyControl->clockpro_lock);
+	{
+		bool		ghost_hit = ClockProAdapt();
+
+		buf = ClockProGetVictim(buf_state);
+		if (buf == NULL)
+		{
+			SpinLockRelease(&StrategyControl->clockpro_lock);
+			elog(ERROR, "no unpinned buffers available");
+		}
+
+		if (strategy != NULL)
+			AddBufferToRing(strategy, buf);
+		ClockProLoadBuffer(buf, *buf_state, ghost_hit);
+	}
+	SpinLockRelease(&StrategyControl->clockpro_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the clock
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* size of the clock nodes, including ghost entries */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(ClockProNode), CLOCKPRO_NODES)));
+
+	/* size of the ghost entries and their hash buckets */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(ClockProGhost), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int32), NBuffers)));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		clockpro_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->clockpro_lock);
+		StrategyControl->handHot = CLOCKPRO_NODE_NOT_IN_LIST;
+		StrategyControl->handCold = CLOCKPRO_NODE_NOT_IN_LIST;
+		StrategyControl->handTest = CLOCKPRO_NODE_NOT_IN_LIST;
+		StrategyControl->countHot = 0;
+		StrategyControl->countCold = 0;
+		StrategyControl->countNonResident = 0;
+		StrategyControl->coldTarget = Max(NBuffers / 2, 1);
+		StrategyControl->firstFreeGhost = 0;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+		Assert(!init);
+
+	/* Get or create the clock nodes and ghost entries, the clock starts empty */
+	clockproNodes = (ClockProNode *)
+		ShmemInitStruct("CLOCK-Pro clock nodes",
+						MAXALIGN(mul_size(sizeof(ClockProNode), CLOCKPRO_NODES)),
+						&clockpro_found);
+	clockproGhosts = (ClockProGhost *)
+		ShmemInitStruct("CLOCK-Pro ghost entries",
+						MAXALIGN(mul_size(sizeof(ClockProGhost), NBuffers)),
+						&clockpro_found);
+	clockproGhostBuckets = (int32 *)
+		ShmemInitStruct("CLOCK-Pro ghost hash buckets",
+						MAXALIGN(mul_size(sizeof(int32), NBuffers)),
+						&clockpro_found);
+
+	if (!clockpro_found)
+	{
+		Assert(init);
+
+		for (int i = 0; i < CLOCKPRO_NODES; i++)
+		{
+			clockproNodes[i].prev = CLOCKPRO_NODE_NOT_IN_LIST;
+			clockproNodes[i].next = CLOCKPRO_NODE_NOT_IN_LIST;
+			clockproNodes[i].status = CLOCKPRO_STATUS_NONE;
+		}
+
+		// every ghost entry starts out unused
+		for (int i = 0; i < NBuffers; i++)
+		{
+			clockproGhosts[i].hashNext = (i + 1 < NBuffers) ? i + 1 : CLOCKPRO_GHOST_NONE;
+			clockproGhostBuckets[i] = CLOCKPRO_GHOST_NONE;
+		}
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
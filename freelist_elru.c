@@ -23,6 +23,79 @@
 
 #define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
 
+/*
+ * ELRU (LRU-2) keeps every buffer that is in use in one of three sets:
+ *
+ *	A1	 - buffers referenced exactly once since they were loaded, ordered by
+ *		   that reference, most recent at the top.
+ *	A2	 - buffers referenced at least twice, ordered by their second most
+ *		   recent reference (their backward 2-distance), most recent at the
+ *		   top.
+ *	RING - buffers loaded for a buffer access strategy ring and not
+ *		   referenced since, most recently loaded at the top.
+ *
+ * The victim is the bottom-most unpinned buffer of RING, then of A1, then of
+ * A2, so a buffer that has only been touched once, e.g. by a large scan,
+ * never displaces a buffer that has been re-referenced.  A ring reuses its
+ * own buffers without the lists noticing, see GetBufferFromRing, so they
+ * sit on RING until someone else references or evicts them.
+ *
+ * A1 and RING are lists of buffers.  A2 is kept in order without searching
+ * for insert positions through the reference list: the two most recent
+ * references of each A2 buffer and the reference of each A1 buffer, most
+ * recent at the top.  A reference always goes on top, so the list stays
+ * ordered by stamp, and an A2 buffer's second most recent reference stays
+ * where it was put when it was the most recent one.  The A2 buffers in
+ * order are thus the second most recent references on the reference list.
+ *
+ * Nodes are linked by int32 index into elruNodes[], like the LRU stack in
+ * freelist_lru.c: entries 0 .. NBuffers - 1 are the buffers' A1 or RING
+ * nodes, entries NBuffers .. 3 * NBuffers - 1 their two reference nodes, and
+ * after them come the head and tail sentinels of A1, of the reference list
+ * and of RING.
+ */
+typedef struct BufferNode
+{
+	int32		prev;
+	int32		next;
+} BufferNode;
+
+#define ELRU_NODE_NOT_IN_LIST	(-1)
+
+#define ELRU_LIST_NONE	0
+#define ELRU_LIST_A1	1
+#define ELRU_LIST_A2	2		/* a set, its list is the reference list */
+#define ELRU_LIST_RING	3
+
+/* reference node i (0 or 1) of a buffer */
+#define ElruRefNode(buf_id, i)	(NBuffers + 2 * (buf_id) + (i))
+
+/*
+ * sentinel entries of list A1, RING or the reference list (ELRU_LIST_A2):
+ * top is head.next, bottom tail.prev
+ */
+#define ElruListHead(list)	(3 * NBuffers + 2 * ((list) - 1))
+#define ElruListTail(list)	(3 * NBuffers + 2 * ((list) - 1) + 1)
+
+#define ELRU_NODES		(3 * NBuffers + 6)
+
+/*
+ * Reference history of a buffer.  Stamps come from StrategyControl->
+ * accessClock; lastAccess is the most recent reference and prevAccess the
+ * one before it (only meaningful while the buffer is in A2).  lastRef tells
+ * which reference node holds lastAccess; in A2 the other holds prevAccess.
+ */
+typedef struct ElruBufferInfo
+{
+	uint64		lastAccess;
+	uint64		prevAccess;
+	int			list;			/* ELRU_LIST_xxx */
+	int			lastRef;		/* 0 or 1, see ElruRefNode */
+} ElruBufferInfo;
+
+static BufferNode *elruNodes = NULL;
+static ElruBufferInfo *elruInfo = NULL;
+
 
 /*
  * The shared freelist control information.
@@ -42,6 +115,16 @@ typedef struct
 	int			firstFreeBuffer;	/* Head of list of unused buffers */
 	int			lastFreeBuffer; /* Tail of list of unused buffers */
 
+	/*
+	 * Spinlock: protects the ELRU lists, elruInfo[] and accessClock.
+	 * When a buffer header spinlock is needed as well, elru_lock is always
+	 * taken first.
+	 */
+	slock_t		elru_lock;
+
+	/* Source of ElruBufferInfo stamps, advanced on every reference */
+	uint64		accessClock;
+
 	/*
 	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
 	 * when the list is empty)
@@ -183,15 +266,239 @@ have_free_buffer(void)
 }
 
 
+/*
+ * ElruNodeUnlink -- unlink a node from the list it is on.
+ *
+ * Caller must hold elru_lock.
+ */
+static inline void
+ElruNodeUnlink(int32 node)
+{
+	BufferNode *curr = &elruNodes[node];
+
+	elruNodes[curr->prev].next = curr->next;
+	elruNodes[curr->next].prev = curr->prev;
+
+	curr->prev = ELRU_NODE_NOT_IN_LIST;
+	curr->next = ELRU_NODE_NOT_IN_LIST;
+}
+
+/*
+ * ElruNodePushTop -- link a node that is on no list at the top of list.
+ *
+ * Caller must hold elru_lock.
+ */
+static inline void
+ElruNodePushTop(int list, int32 node)
+{
+	BufferNode *curr = &elruNodes[node];
+	int32		head = ElruListHead(list);
+
+	curr->prev = head;
+	curr->next = elruNodes[head].next;
+	elruNodes[curr->next].prev = node;
+	elruNodes[head].next = node;
+}
+
+/*
+ * ElruListRemove -- take buffer out of the ELRU lists, if it is on them.
+ *
+ * Caller must hold elru_lock.
+ */
+static inline void
+ElruListRemove(int buf_id)
+{
+	ElruBufferInfo *info = &elruInfo[buf_id];
+
+	switch (info->list)
+	{
+		case ELRU_LIST_NONE:
+			return;
+		case ELRU_LIST_A1:
+			ElruNodeUnlink(buf_id);
+			ElruNodeUnlink(ElruRefNode(buf_id, info->lastRef));
+			break;
+		case ELRU_LIST_A2:
+			ElruNodeUnlink(ElruRefNode(buf_id, 0));
+			ElruNodeUnlink(ElruRefNode(buf_id, 1));
+			break;
+		case ELRU_LIST_RING:
+			ElruNodeUnlink(buf_id);
+			break;
+	}
+	info->list = ELRU_LIST_NONE;
+}
+
+/*
+ * ElruLoadBuffer -- note the first reference to a buffer that is being
+ *		(re)loaded with a new page: forget its history and put it at the top
+ *		of A1.
+ *
+ * Caller must hold elru_lock.
+ */
+static void
+ElruLoadBuffer(int buf_id)
+{
+	ElruBufferInfo *info = &elruInfo[buf_id];
+
+	ElruListRemove(buf_id);
+
+	info->lastAccess = ++StrategyControl->accessClock;
+	info->prevAccess = 0;
+	ElruNodePushTop(ELRU_LIST_A1, buf_id);
+	ElruNodePushTop(ELRU_LIST_A2, ElruRefNode(buf_id, info->lastRef));
+	info->list = ELRU_LIST_A1;
+}
+
+/*
+ * ElruLoadRingBuffer -- note that a buffer is being (re)loaded with a new
+ *		page for a buffer access strategy ring: forget its history and put it
+ *		at the top of RING.
+ *
+ * Caller must hold elru_lock.
+ */
+static void
+ElruLoadRingBuffer(int buf_id)
+{
+	ElruBufferInfo *info = &elruInfo[buf_id];
+
+	ElruListRemove(buf_id);
+
+	info->lastAccess = ++StrategyControl->accessClock;
+	info->prevAccess = 0;
+	ElruNodePushTop(ELRU_LIST_RING, buf_id);
+	info->list = ELRU_LIST_RING;
+}
+
+/*
+ * ElruReferenceBuffer -- note a further reference to a buffer that is
+ *		already loaded.
+ *
+ * The buffer's previous last reference becomes its second most recent one
+ * and keeps its place on the reference list, which is thereby the buffer's
+ * place in A2.  The new reference goes on top, in the reference node the
+ * reference before the previous one is dropped from.
+ *
+ * Caller must hold elru_lock.
+ */
+static void
+ElruReferenceBuffer(int buf_id)
+{
+	ElruBufferInfo *info = &elruInfo[buf_id];
+
+	// a buffer on no list is treated as freshly loaded, and so is one that
+	// was loaded for a ring: the ring's own reference does not count
+	if (info->list == ELRU_LIST_NONE || info->list == ELRU_LIST_RING)
+	{
+		ElruLoadBuffer(buf_id);
+		return;
+	}
+
+	if (info->list == ELRU_LIST_A1)
+		ElruNodeUnlink(buf_id);
+	else
+		ElruNodeUnlink(ElruRefNode(buf_id, 1 - info->lastRef));
+
+	info->prevAccess = info->lastAccess;
+	info->lastAccess = ++StrategyControl->accessClock;
+	info->lastRef = 1 - info->lastRef;
+	ElruNodePushTop(ELRU_LIST_A2, ElruRefNode(buf_id, info->lastRef));
+	info->list = ELRU_LIST_A2;
+}
+
+/*
+ * ElruGetVictim -- return the bottom-most unpinned buffer of list A1 or
+ *		RING, with its header spinlock held, or NULL if every buffer on list
+ *		is pinned.
+ *
+ * Caller must hold elru_lock.
+ */
+static BufferDesc *
+ElruGetVictim(int list, uint32 *buf_state)
+{
+	int32		victim;
+
+	for (victim = elruNodes[ElruListTail(list)].prev;
+		 victim != ElruListHead(list);
+		 victim = elruNodes[victim].prev)
+	{
+		BufferDesc *buf = GetBufferDescriptor(victim);
+		uint32		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by ELRU, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+	}
+
+	return NULL;
+}
+
+/*
+ * ElruGetA2Victim -- return the unpinned buffer of A2 with the oldest second
+ *		most recent reference, with its header spinlock held, or NULL if every
+ *		buffer in A2 is pinned.
+ *
+ * The reference list is walked from the bottom, skipping most recent
+ * references: a buffer's second most recent reference is further down than
+ * its most recent one, so it has already been looked at.
+ *
+ * Caller must hold elru_lock.
+ */
+static BufferDesc *
+ElruGetA2Victim(uint32 *buf_state)
+{
+	int32		node;
+
+	for (node = elruNodes[ElruListTail(ELRU_LIST_A2)].prev;
+		 node != ElruListHead(ELRU_LIST_A2);
+		 node = elruNodes[node].prev)
+	{
+		int			victim = (node - NBuffers) / 2;
+		BufferDesc *buf;
+		uint32		local_buf_state;
+
+		if (elruInfo[victim].list != ELRU_LIST_A2 ||
+			node == ElruRefNode(victim, elruInfo[victim].lastRef))
+			continue;
+
+		buf = GetBufferDescriptor(victim);
+		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by ELRU, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+	}
+
+	return NULL;
+}
+
 // cs3223
 // StrategyAccessBuffer 
 // Called by bufmgr when a buffer page is accessed.
-// Adjusts the position of buffer (identified by buf_id) in the LRU stack if delete is false;
-// otherwise, delete buffer buf_id from the LRU stack.
+// Adjusts the position of buffer (identified by buf_id) in the ELRU lists if delete is false;
+// otherwise, delete buffer buf_id from the ELRU lists.
 void
 StrategyAccessBuffer(int buf_id, bool delete)
 {
-	elog(ERROR, "StrategyAccessBuffer: Not implemented!");
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	SpinLockAcquire(&StrategyControl->elru_lock);
+
+	if (delete)
+		ElruListRemove(buf_id);
+	else
+		ElruReferenceBuffer(buf_id);
+
+	SpinLockRelease(&StrategyControl->elru_lock);
 }
 
 /*
@@ -211,14 +518,14 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_r
 {
 	BufferDesc *buf;
 	int			bgwprocno;
-	int			trycounter;
 	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
 
 	*from_ring = false;
 
 	/*
 	 * If given a strategy object, see whether it can select a buffer. We
-	 * assume strategy objects don't need buffer_strategy_lock.
+	 * assume strategy objects don't need buffer_strategy_lock.  A reused ring
+	 * buffer stays where it is on RING, so elru_lock isn't needed either.
 	 */
 	if (strategy != NULL)
 	{
@@ -306,68 +613,64 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_r
 			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
 
 			/*
-			 * If the buffer is pinned or has a nonzero usage_count, we cannot
-			 * use it; discard it and retry.  (This can only happen if VACUUM
-			 * put a valid buffer in the freelist and then someone else used
-			 * it before we got to it.  It's probably impossible altogether as
-			 * of 8.3, but we'd better check anyway.)
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For elru implementation, usage_count is not important or ignored.
 			 */
+			SpinLockAcquire(&StrategyControl->elru_lock);
 			local_buf_state = LockBufHdr(buf);
-			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
-				&& BUF_STATE_GET_USAGECOUNT(local_buf_state) == 0)
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
 			{
 				if (strategy != NULL)
+				{
 					AddBufferToRing(strategy, buf);
+					ElruLoadRingBuffer(buf->buf_id);
+				}
+				else
+					ElruLoadBuffer(buf->buf_id);
+				SpinLockRelease(&StrategyControl->elru_lock);
 				*buf_state = local_buf_state;
 				return buf;
 			}
 			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->elru_lock);
 		}
 	}
 
-	/* Nothing on the freelist, so run the "clock sweep" algorithm */
-	trycounter = NBuffers;
-	for (;;)
-	{
-		buf = GetBufferDescriptor(ClockSweepTick());
+	/*
+	 * Nothing on the freelist, so run ELRU: take the least recently loaded
+	 * ring buffer, else the least recently used buffer that was referenced
+	 * only once, and only if there is none fall back to the buffer whose
+	 * second most recent reference is the oldest.
+	 */
+	SpinLockAcquire(&StrategyControl->elru_lock);
 
-		/*
-		 * If the buffer is pinned or has a nonzero usage_count, we cannot use
-		 * it; decrement the usage_count (unless pinned) and keep scanning.
-		 */
-		local_buf_state = LockBufHdr(buf);
+	buf = ElruGetVictim(ELRU_LIST_RING, buf_state);
+	if (buf == NULL)
+		buf = ElruGetVictim(ELRU_LIST_A1, buf_state);
+	if (buf == NULL)
+		buf = ElruGetA2Victim(buf_state);
 
-		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
-		{
-			if (BUF_STATE_GET_USAGECOUNT(local_buf_state) != 0)
-			{
-				local_buf_state -= BUF_USAGECOUNT_ONE;
+	if (buf == NULL)
+	{
+		SpinLockRelease(&StrategyControl->elru_lock);
+		elog(ERROR, "no unpinned buffers available");
+	}
 
-				trycounter = NBuffers;
-			}
-			else
-			{
-				/* Found a usable buffer */
-				if (strategy != NULL)
-					AddBufferToRing(strategy, buf);
-				*buf_state = local_buf_state;
-				return buf;
-			}
-		}
-		else if (--trycounter == 0)
-		{
-			/*
-			 * We've scanned all the buffers without making any state changes,
-			 * so all the buffers are pinned (or were when we looked at them).
-			 * We could hope that someone will free one eventually, but it's
-			 * probably better to fail than to risk getting stuck in an
-			 * infinite loop.
-			 */
-			UnlockBufHdr(buf, local_buf_state);
-			elog(ERROR, "no unpinned buffers available");
-		}
-		UnlockBufHdr(buf, local_buf_state);
+	if (strategy != NULL)
+	{
+		AddBufferToRing(strategy, buf);
+		ElruLoadRingBuffer(buf->buf_id);
 	}
+	else
+		ElruLoadBuffer(buf->buf_id);
+
+	SpinLockRelease(&StrategyControl->elru_lock);
+	return buf;
 }
 
 /*
@@ -388,6 +691,8 @@ StrategyFreeBuffer(BufferDesc *buf)
 		if (buf->freeNext < 0)
 			StrategyControl->lastFreeBuffer = buf->buf_id;
 		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the ELRU lists
+		StrategyAccessBuffer(buf->buf_id, true);
 	}
 
 	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
@@ -474,6 +779,12 @@ StrategyShmemSize(void)
 	/* size of the shared replacement strategy control block */
 	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
 
+	/* size of the ELRU list nodes, including the list sentinels */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(BufferNode), ELRU_NODES)));
+
+	/* size of the per-buffer reference history */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(ElruBufferInfo), NBuffers)));
+
 	return size;
 }
 
@@ -488,6 +799,7 @@ void
 StrategyInitialize(bool init)
 {
 	bool		found;
+	bool		elru_found;
 
 	/*
 	 * Initialize the shared buffer lookup hashtable.
@@ -525,6 +837,9 @@ StrategyInitialize(bool init)
 		StrategyControl->firstFreeBuffer = 0;
 		StrategyControl->lastFreeBuffer = NBuffers - 1;
 
+		SpinLockInit(&StrategyControl->elru_lock);
+		StrategyControl->accessClock = 0;
+
 		/* Initialize the clock sweep pointer */
 		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
 
@@ -537,6 +852,45 @@ StrategyInitialize(bool init)
 	}
 	else
 		Assert(!init);
+
+	/* Get or create the ELRU lists and reference history, both start empty */
+	elruNodes = (BufferNode *)
+		ShmemInitStruct("ELRU list nodes",
+						MAXALIGN(mul_size(sizeof(BufferNode), ELRU_NODES)),
+						&elru_found);
+	elruInfo = (ElruBufferInfo *)
+		ShmemInitStruct("ELRU buffer history",
+						MAXALIGN(mul_size(sizeof(ElruBufferInfo), NBuffers)),
+						&elru_found);
+
+	if (!elru_found)
+	{
+		Assert(init);
+
+		for (int i = 0; i < 3 * NBuffers; i++)
+		{
+			elruNodes[i].prev = ELRU_NODE_NOT_IN_LIST;
+			elruNodes[i].next = ELRU_NODE_NOT_IN_LIST;
+		}
+
+		for (int i = 0; i < NBuffers; i++)
+		{
+			elruInfo[i].lastAccess = 0;
+			elruInfo[i].prevAccess = 0;
+			elruInfo[i].list = ELRU_LIST_NONE;
+			elruInfo[i].lastRef = 0;
+		}
+
+		for (int list = ELRU_LIST_A1; list <= ELRU_LIST_RING; list++)
+		{
+			elruNodes[ElruListHead(list)].prev = ELRU_NODE_NOT_IN_LIST;
+			elruNodes[ElruListHead(list)].next = ElruListTail(list);
+			elruNodes[ElruListTail(list)].prev = ElruListHead(list);
+			elruNodes[ElruListTail(list)].next = ELRU_NODE_NOT_IN_LIST;
+		}
+	}
+	else
+		Assert(!init);
 }
 
 
@@ -692,11 +1046,20 @@ GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
 	 * there, but it might've been decremented by clock sweep since then). A
 	 * higher usage_count indicates someone else has touched the buffer, so we
 	 * shouldn't re-use it.
+	 *
+	 * Likewise a buffer that has left RING was referenced again or evicted,
+	 * and belongs to the ELRU lists now.  That is read without elru_lock.
+	 * References and evictions change the list while the buffer is pinned
+	 * or its header is locked, so with the header lock held and no pins we
+	 * see them; only a concurrent StrategyFreeBuffer can be missed, and then
+	 * we reuse a buffer that is also on the freelist, which StrategyGetBuffer
+	 * copes with already.
 	 */
 	buf = GetBufferDescriptor(bufnum - 1);
 	local_buf_state = LockBufHdr(buf);
 	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
-		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1
+		&& elruInfo[buf->buf_id].list == ELRU_LIST_RING)
 	{
 		*buf_state = local_buf_state;
 		return buf;
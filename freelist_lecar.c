@@ -0,0 +1,1420 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "common/pg_prng.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * LeCaR (Learning Cache Replacement, Vietri et al.) lets two experts
+ * propose victims, and learns from its mistakes which one to follow:
+ *
+ *	LRU - proposes the least recently used buffer.
+ *	LFU - proposes the least frequently used buffer, the least recently
+ *		  used one among equals.
+ *
+ * Each eviction follows one expert, chosen at random with probability
+ * wLru or wLfu, which add up to 1.  The evicted page's tag goes to that
+ * expert's history, H_LRU or H_LFU.  A miss on a page found in a history
+ * means the expert was wrong to evict it: the weight of the other expert
+ * is multiplied by e^(LECAR_LEARNING_RATE * r) and both are normalised,
+ * where the regret r = LECAR_DISCOUNT ^ (time since the eviction) makes old
+ * mistakes count less.  The policy follows LRU while the working set fits
+ * (OLTP) and LFU while scans churn through the cache (batch), and shifts
+ * between the two as the workload does.  Time is counted in references.
+ *
+ * The buffers in use are on the LRU list, most recently used at the top,
+ * and in the LFU heap, lecarHeap[].  Nodes of the LRU list and of the
+ * histories are linked by int32 index into lecarNodes[], like the LRU stack
+ * in freelist_lru.c: entries 0 .. NBuffers - 1 belong to the buffers,
+ * entries NBuffers .. 2 * NBuffers - 1 are history entries, followed by the
+ * head and tail sentinels of the three lists.  The two histories share the
+ * NBuffers history entries.
+ */
+#define LECAR_LEARNING_RATE	0.45
+#define LECAR_DISCOUNT		pow(0.005, 1.0 / NBuffers)
+
+typedef struct LecarNode
+{
+	int32		prev;
+	int32		next;
+	int			list;			/* LECAR_LIST_xxx */
+} LecarNode;
+
+#define LECAR_NODE_NOT_IN_LIST	(-1)
+
+#define LECAR_LIST_NONE		0
+#define LECAR_LIST_LRU		1
+#define LECAR_LIST_H_LRU	2
+#define LECAR_LIST_H_LFU	3
+#define LECAR_NUM_LISTS		3
+
+/* the experts, named by the history their victims go to */
+#define LECAR_EXPERT_NONE	LECAR_LIST_NONE
+#define LECAR_EXPERT_LRU	LECAR_LIST_H_LRU
+#define LECAR_EXPERT_LFU	LECAR_LIST_H_LFU
+
+/* sentinel entries of a list: top is head.next, bottom tail.prev */
+#define LecarListHead(list)	(2 * NBuffers + 2 * ((list) - 1))
+#define LecarListTail(list)	(2 * NBuffers + 2 * ((list) - 1) + 1)
+
+#define LecarGhostNode(ghost)	(NBuffers + (ghost))
+#define LecarNodeGhost(node)	((node) - NBuffers)
+
+#define LECAR_NODES		(2 * NBuffers + 2 * LECAR_NUM_LISTS)
+
+/* LFU state of a buffer in use */
+typedef struct LecarBufferInfo
+{
+	uint32		frequency;		/* references since the page was read in */
+	uint64		lastAccess;		/* time of the last reference */
+	int			heapPos;		/* position in lecarHeap[], or -1 if the buffer
+								 * is not in use */
+} LecarBufferInfo;
+
+/*
+ * A history entry holds the tag of an evicted page, its reference count,
+ * which it continues with if read in again, and the time of its eviction.
+ * History entries are found by tag through a chained hash table,
+ * lecarGhostBuckets[]; hashNext also links the unused entries together.
+ */
+typedef struct LecarGhost
+{
+	BufferTag	tag;
+	uint32		frequency;
+	uint64		evictTime;
+	int32		hashNext;
+} LecarGhost;
+
+#define LECAR_GHOST_NONE	(-1)
+
+static LecarNode *lecarNodes = NULL;
+static LecarBufferInfo *lecarInfo = NULL;
+static int *lecarHeap = NULL;
+static LecarGhost *lecarGhosts = NULL;
+static int32 *lecarGhostBuckets = NULL;
+
+/*
+ * Number of heap positions LecarLfuVictim examines before giving up on the
+ * heap order and falling back to a scan of the whole heap.  Only reached
+ * when that many buffers near the top of the heap are pinned.
+ */
+#define LECAR_MAX_CANDIDATES	64
+
+/*
+ * Tag of the page bufmgr is about to read in, see StrategySetIncomingTag.
+ * Backend-private.
+ */
+static BufferTag lecarIncomingTag;
+static bool lecarHaveIncomingTag = false;
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects the LRU list, the LFU heap, the histories and the
+	 * fields below.  When a buffer header spinlock is needed as well,
+	 * lecar_lock is always taken first.
+	 */
+	slock_t		lecar_lock;
+
+	uint64		currentTime;	/* advanced on every reference */
+	double		wLru;			/* weight of the LRU expert */
+	double		wLfu;			/* weight of the LFU expert, 1 - wLru */
+	int			heapSize;		/* number of buffers in lecarHeap[] */
+	int			listLength[LECAR_NUM_LISTS + 1];	/* indexed by LECAR_LIST_xxx */
+	int32		firstFreeGhost; /* head of list of unused history entries */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+/*
+ * LecarListRemove -- unlink node from the list it is on, if any.
+ *
+ * Caller must hold lecar_lock.
+ */
+static inline void
+LecarListRemove(int32 node)
+{
+	LecarNode  *curr = &lecarNodes[node];
+
+	if (curr->list == LECAR_LIST_NONE)
+		return;
+
+	lecarNodes[curr->prev].next = curr->next;
+	lecarNodes[curr->next].prev = curr->prev;
+	StrategyControl->listLength[curr->list]--;
+
+	curr->prev = LECAR_NODE_NOT_IN_LIST;
+	curr->next = LECAR_NODE_NOT_IN_LIST;
+	curr->list = LECAR_LIST_NONE;
+}
+
+/*
+ * LecarListPushTop -- link node in at the top of list.
+ *
+ * Caller must hold lecar_lock, and the node must not be on any list.
+ */
+static inline void
+LecarListPushTop(int list, int32 node)
+{
+	LecarNode  *curr = &lecarNodes[node];
+	int32		head = LecarListHead(list);
+
+	curr->prev = head;
+	curr->next = lecarNodes[head].next;
+	lecarNodes[curr->next].prev = node;
+	lecarNodes[head].next = node;
+	curr->list = list;
+	StrategyControl->listLength[list]++;
+}
+
+/*
+ * LecarBetterVictim -- is buffer a a better victim than buffer b for the LFU
+ *		expert?
+ */
+static inline bool
+LecarBetterVictim(int a, int b)
+{
+	LecarBufferInfo *ia = &lecarInfo[a];
+	LecarBufferInfo *ib = &lecarInfo[b];
+
+	if (ia->frequency != ib->frequency)
+		return ia->frequency < ib->frequency;
+	return ia->lastAccess < ib->lastAccess;
+}
+
+static inline void
+LecarHeapSet(int pos, int buf_id)
+{
+	lecarHeap[pos] = buf_id;
+	lecarInfo[buf_id].heapPos = pos;
+}
+
+/*
+ * LecarHeapSiftUp / LecarHeapSiftDown -- restore the heap order around pos.
+ *
+ * Caller must hold lecar_lock.
+ */
+static void
+LecarHeapSiftUp(int pos)
+{
+	int			buf_id = lecarHeap[pos];
+
+	while (pos > 0)
+	{
+		int			parent = (pos - 1) / 2;
+
+		if (!LecarBetterVictim(buf_id, lecarHeap[parent]))
+			break;
+		LecarHeapSet(pos, lecarHeap[parent]);
+		pos = parent;
+	}
+	LecarHeapSet(pos, buf_id);
+}
+
+static void
+LecarHeapSiftDown(int pos)
+{
+	int			buf_id = lecarHeap[pos];
+	int			size = StrategyControl->heapSize;
+
+	for (;;)
+	{
+		int			child = 2 * pos + 1;
+
+		if (child >= size)
+			break;
+		if (child + 1 < size && LecarBetterVictim(lecarHeap[child + 1], lecarHeap[child]))
+			child++;
+		if (!LecarBetterVictim(lecarHeap[child], buf_id))
+			break;
+		LecarHeapSet(pos, lecarHeap[child]);
+		pos = child;
+	}
+	LecarHeapSet(pos, buf_id);
+}
+
+/*
+ * LecarRemoveBuffer -- take buffer off the LRU list and out of the LFU heap,
+ *		if it is in use.
+ *
+ * Caller must hold lecar_lock.
+ */
+static void
+LecarRemoveBuffer(int buf_id)
+{
+	int			pos = lecarInfo[buf_id].heapPos;
+	int			last;
+
+	LecarListRemove(buf_id);
+
+	if (pos < 0)
+		return;
+
+	lecarInfo[buf_id].heapPos = -1;
+	last = lecarHeap[--StrategyControl->heapSize];
+	if (last == buf_id)
+		return;
+
+	LecarHeapSet(pos, last);
+	LecarHeapSiftUp(pos);
+	LecarHeapSiftDown(lecarInfo[last].heapPos);
+}
+
+/*
+ * LecarReferenceBuffer -- count a reference to the page in buffer, moving it
+ *		to the top of the LRU list and down the LFU heap.
+ *
+ * Caller must hold lecar_lock.
+ */
+static void
+LecarReferenceBuffer(int buf_id)
+{
+	LecarBufferInfo *info = &lecarInfo[buf_id];
+
+	info->frequency++;
+	info->lastAccess = ++StrategyControl->currentTime;
+
+	LecarListRemove(buf_id);
+	LecarListPushTop(LECAR_LIST_LRU, buf_id);
+
+	// a reference only makes the buffer a worse victim
+	LecarHeapSiftDown(info->heapPos);
+}
+
+static inline int32 *
+LecarGhostBucket(BufferTag *tag)
+{
+	return &lecarGhostBuckets[BufTableHashCode(tag) % NBuffers];
+}
+
+/*
+ * LecarGhostLookup -- return the history entry remembering tag, or
+ *		LECAR_GHOST_NONE.
+ *
+ * Caller must hold lecar_lock.
+ */
+static int32
+LecarGhostLookup(BufferTag *tag)
+{
+	int32		ghost;
+
+	for (ghost = *LecarGhostBucket(tag);
+		 ghost != LECAR_GHOST_NONE;
+		 ghost = lecarGhosts[ghost].hashNext)
+	{
+		if (BufferTagsEqual(&lecarGhosts[ghost].tag, tag))
+			return ghost;
+	}
+
+	return LECAR_GHOST_NONE;
+}
+
+/*
+ * LecarGhostForget -- take a history entry off its list and out of the hash
+ *		table, and make it available for reuse.
+ *
+ * Caller must hold lecar_lock.
+ */
+static void
+LecarGhostForget(int32 ghost)
+{
+	int32	   *link = LecarGhostBucket(&lecarGhosts[ghost].tag);
+
+	while (*link != ghost)
+		link = &lecarGhosts[*link].hashNext;
+	*link = lecarGhosts[ghost].hashNext;
+
+	LecarListRemove(LecarGhostNode(ghost));
+
+	lecarGhosts[ghost].hashNext = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = ghost;
+}
+
+/*
+ * LecarGhostRemember -- put the tag and reference count of the page evicted
+ *		from buffer at the top of the history of the expert that chose it.
+ *
+ * When all history entries are in use, the oldest entry of that history is
+ * forgotten, or of the other history if that one is empty.
+ *
+ * Caller must hold lecar_lock.
+ */
+static void
+LecarGhostRemember(int expert, BufferDesc *buf)
+{
+	int32		ghost;
+	int32	   *bucket;
+
+	if (StrategyControl->firstFreeGhost == LECAR_GHOST_NONE)
+	{
+		int			list = expert;
+
+		if (StrategyControl->listLength[list] == 0)
+			list = (expert == LECAR_EXPERT_LRU) ? LECAR_EXPERT_LFU : LECAR_EXPERT_LRU;
+		LecarGhostForget(LecarNodeGhost(lecarNodes[LecarListTail(list)].prev));
+	}
+
+	ghost = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = lecarGhosts[ghost].hashNext;
+
+	bucket = LecarGhostBucket(&buf->tag);
+	lecarGhosts[ghost].tag = buf->tag;
+	lecarGhosts[ghost].frequency = lecarInfo[buf->buf_id].frequency;
+	lecarGhosts[ghost].evictTime = StrategyControl->currentTime;
+	lecarGhosts[ghost].hashNext = *bucket;
+	*bucket = ghost;
+
+	LecarListPushTop(expert, LecarGhostNode(ghost));
+}
+
+/*
+ * LecarLearn -- look the incoming page up in the histories; if it is found
+ *		there, the expert that evicted it was wrong, so shift weight to the
+ *		other one.
+ *
+ * Returns the reference count the page continues with, 0 if it is not in a
+ * history.  The history entry itself is forgotten, as the page is about to
+ * become resident again.
+ *
+ * Caller must hold lecar_lock.
+ */
+static uint32
+LecarLearn(void)
+{
+	int32		ghost;
+	uint32		frequency;
+	double		regret;
+
+	if (!lecarHaveIncomingTag)
+		return 0;
+
+	ghost = LecarGhostLookup(&lecarIncomingTag);
+	if (ghost == LECAR_GHOST_NONE)
+		return 0;
+
+	regret = pow(LECAR_DISCOUNT,
+				 (double) (StrategyControl->currentTime - lecarGhosts[ghost].evictTime));
+	if (lecarNodes[LecarGhostNode(ghost)].list == LECAR_LIST_H_LRU)
+		StrategyControl->wLfu *= exp(LECAR_LEARNING_RATE * regret);
+	else
+		StrategyControl->wLru *= exp(LECAR_LEARNING_RATE * regret);
+
+	StrategyControl->wLru /= StrategyControl->wLru + StrategyControl->wLfu;
+	StrategyControl->wLfu = 1.0 - StrategyControl->wLru;
+
+	frequency = lecarGhosts[ghost].frequency;
+	LecarGhostForget(ghost);
+	return frequency;
+}
+
+/*
+ * LecarLoadBuffer -- note that buffer is about to be (re)loaded with the
+ *		incoming page, evicting the previous one on behalf of expert.
+ *
+ * The page previously held in the buffer, if any, is remembered in the
+ * expert's history; a buffer reused from the freelist or a ring has no
+ * expert to blame.  The caller holds the buffer header spinlock, so
+ * buf->tag and buf_state still describe the previous page.
+ *
+ * Caller must hold lecar_lock.
+ */
+static void
+LecarLoadBuffer(BufferDesc *buf, uint32 buf_state, int expert)
+{
+	LecarBufferInfo *info = &lecarInfo[buf->buf_id];
+	uint32		frequency;
+
+	// learn first, so that remembering the previous page cannot push the
+	// incoming one out of its history
+	frequency = LecarLearn();
+
+	if (expert != LECAR_EXPERT_NONE && info->heapPos >= 0 &&
+		(buf_state & BM_TAG_VALID))
+		LecarGhostRemember(expert, buf);
+
+	LecarRemoveBuffer(buf->buf_id);
+
+	info->frequency = frequency;
+	LecarHeapSet(StrategyControl->heapSize++, buf->buf_id);
+	LecarReferenceBuffer(buf->buf_id);
+	LecarHeapSiftUp(info->heapPos);
+}
+
+/*
+ * LecarLruVictim -- return the least recently used unpinned buffer, with its
+ *		header spinlock held, or NULL if every buffer is pinned.
+ *
+ * Caller must hold lecar_lock.
+ */
+static BufferDesc *
+LecarLruVictim(uint32 *buf_state)
+{
+	int32		victim;
+
+	for (victim = lecarNodes[LecarListTail(LECAR_LIST_LRU)].prev;
+		 victim != LecarListHead(LECAR_LIST_LRU);
+		 victim = lecarNodes[victim].prev)
+	{
+		BufferDesc *buf = GetBufferDescriptor(victim);
+		uint32		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by LeCaR, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+	}
+
+	return NULL;
+}
+
+/*
+ * LecarLfuVictim -- return the least frequently used unpinned buffer, with
+ *		its header spinlock held, or NULL if every buffer is pinned.
+ *
+ * Usually that is the root of the heap.  If the root is pinned, the heap is
+ * searched best-first, like in freelist_lruk.c, and once that has examined
+ * LECAR_MAX_CANDIDATES buffers, the LRU order is used instead.
+ *
+ * Caller must hold lecar_lock.
+ */
+static BufferDesc *
+LecarLfuVictim(uint32 *buf_state)
+{
+	int			candidates[LECAR_MAX_CANDIDATES];
+	int			ncandidates = 0;
+	int			examined = 0;
+
+	if (StrategyControl->heapSize > 0)
+		candidates[ncandidates++] = 0;
+
+	while (ncandidates > 0)
+	{
+		int			best = 0;
+		int			pos;
+		BufferDesc *buf;
+		uint32		local_buf_state;
+
+		for (int i = 1; i < ncandidates; i++)
+		{
+			if (LecarBetterVictim(lecarHeap[candidates[i]], lecarHeap[candidates[best]]))
+				best = i;
+		}
+		pos = candidates[best];
+		candidates[best] = candidates[--ncandidates];
+
+		buf = GetBufferDescriptor(lecarHeap[pos]);
+		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by LeCaR, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+
+		if (++examined >= LECAR_MAX_CANDIDATES - 1)
+			return LecarLruVictim(buf_state);
+
+		for (int child = 2 * pos + 1; child <= 2 * pos + 2; child++)
+		{
+			if (child < StrategyControl->heapSize)
+				candidates[ncandidates++] = child;
+		}
+	}
+
+	return NULL;
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The tag is looked up in the histories.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	lecarHaveIncomingTag = (tag != NULL);
+	if (tag != NULL)
+		lecarIncomingTag = *tag;
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Counts a reference to buffer (identified by buf_id) for both experts if delete is false;
+// otherwise, delete buffer buf_id from the LRU list and the LFU heap.  A dropped page is not remembered
+// in a history.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	SpinLockAcquire(&StrategyControl->lecar_lock);
+
+	if (delete)
+		LecarRemoveBuffer(buf_id);
+	else
+		LecarReferenceBuffer(buf_id);
+
+	SpinLockRelease(&StrategyControl->lecar_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+	int			expert;
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  lecar_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be reloaded while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->lecar_lock);
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			LecarLoadBuffer(buf, *buf_state, LECAR_EXPERT_NONE);
+			SpinLockRelease(&StrategyControl->lecar_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->lecar_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For lecar implementation, usage_count is not important or ignored.
+			 */
+			SpinLockAcquire(&StrategyControl->lecar_lock);
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				LecarLoadBuffer(buf, local_buf_state, LECAR_EXPERT_NONE);
+				SpinLockRelease(&StrategyControl->lecar_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->lecar_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run LeCaR: follow the LRU expert with
+	 * probability wLru, the LFU expert otherwise.  Either expert considers
+	 * every buffer, so if the one followed finds them all pinned, so would
+	 * the other.
+	 */
+	SpinLockAcquire(&StrategyControl->lecar_lock);
+
+	if (pg_prng_double(&pg_global_prng_state) < StrategyControl->wLru)
+	{
+		expert = LECAR_EXPERT_LRU;
+		buf = LecarLruVictim(buf_state);
+	}
+	else
+	{
+		expert = LECAR_EXPERT_LFU;
+		buf = LecarLfuVictim(buf_state);
+	}
+
+	if (buf == NULL)
+	{
+		SpinLockRelease(&StrategyControl->lecar_lock);
+		elog(ERROR, "no unpinned buffers available");
+	}
+
+	if (strategy != NULL)
+		AddBufferToRing(strategy, buf);
+	LecarLoadBuffer(buf, *buf_state, expert);
+
+	SpinLockRelease(&StrategyControl->lecar_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the LeCaR lists
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* size of the LeCaR list nodes, including history entries and sentinels */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LecarNode), LECAR_NODES)));
+
+	/* size of the per-buffer LFU state and of the heap */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LecarBufferInfo), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int), NBuffers)));
+
+	/* size of the history entries and their hash buckets */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LecarGhost), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int32), NBuffers)));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		lecar_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->lecar_lock);
+		StrategyControl->currentTime = 0;
+		StrategyControl->wLru = 0.5;
+		StrategyControl->wLfu = 0.5;
+		StrategyControl->heapSize = 0;
+		for (int list = LECAR_LIST_NONE; list <= LECAR_NUM_LISTS; list++)
+			StrategyControl->listLength[list] = 0;
+		StrategyControl->firstFreeGhost = 0;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+		Assert(!init);
+
+	/*
+	 * Get or create the LeCaR lists, the LFU heap and the history entries;
+	 * all start empty
+	 */
+	lecarNodes = (LecarNode *)
+		ShmemInitStruct("LeCaR list nodes",
+						MAXALIGN(mul_size(sizeof(LecarNode), LECAR_NODES)),
+						&lecar_found);
+	lecarInfo = (LecarBufferInfo *)
+		ShmemInitStruct("LeCaR buffer frequencies",
+						MAXALIGN(mul_size(sizeof(LecarBufferInfo), NBuffers)),
+						&lecar_found);
+	lecarHeap = (int *)
+		ShmemInitStruct("LeCaR heap",
+						MAXALIGN(mul_size(sizeof(int), NBuffers)),
+						&lecar_found);
+	lecarGhosts = (LecarGhost *)
+		ShmemInitStruct("LeCaR history entries",
+						MAXALIGN(mul_size(sizeof(LecarGhost), NBuffers)),
+						&lecar_found);
+	lecarGhostBuckets = (int32 *)
+		ShmemInitStruct("LeCaR history hash buckets",
+						MAXALIGN(mul_size(sizeof(int32), NBuffers)),
+						&lecar_found);
+
+	if (!lecar_found)
+	{
+		Assert(init);
+
+		for (int i = 0; i < 2 * NBuffers; i++)
+		{
+			lecarNodes[i].prev = LECAR_NODE_NOT_IN_LIST;
+			lecarNodes[i].next = LECAR_NODE_NOT_IN_LIST;
+			lecarNodes[i].list = LECAR_LIST_NONE;
+		}
+
+		for (int i = 0; i < NBuffers; i++)
+		{
+			lecarInfo[i].frequency = 0;
+			lecarInfo[i].lastAccess = 0;
+			lecarInfo[i].heapPos = -1;
+		}
+
+		for (int list = LECAR_LIST_LRU; list <= LECAR_NUM_LISTS; list++)
+		{
+			lecarNodes[LecarListHead(list)].prev = LECAR_NODE_NOT_IN_LIST;
+			lecarNodes[LecarListHead(list)].next = LecarListTail(list);
+			lecarNodes[LecarListHead(list)].list = list;
+			lecarNodes[LecarListTail(list)].prev = LecarListHead(list);
+			lecarNodes[LecarListTail(list)].next = LECAR_NODE_NOT_IN_LIST;
+			lecarNodes[LecarListTail(list)].list = list;
+		}
+
+		// every history entry starts out unused
+		for (int i = 0; i < NBuffers; i++)
+		{
+			lecarGhosts[i].hashNext = (i + 1 < NBuffers) ? i + 1 : LECAR_GHOST_NONE;
+			lecarGhostBuckets[i] = LECAR_GHOST_NONE;
+		}
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
@@ -0,0 +1,1329 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * LIRS (Low Inter-reference Recency Set, Jiang and Zhang) ranks pages by
+ * their inter-reference recency (IRR), the number of other pages referenced
+ * between their last two references, rather than by recency alone.  Pages
+ * with a low IRR form the LIR set and take up all but LIRS_HIR_BUFFERS of
+ * the buffers; the remaining buffers hold pages of the HIR set, and only
+ * those are ever evicted.  A loop over a few more pages than there are
+ * buffers thus keeps most of its pages resident, where LRU misses on every
+ * single reference.
+ *
+ * Two orderings are kept:
+ *
+ *	S - the LIRS stack: LIR pages, and HIR pages (resident or not) that were
+ *		referenced more recently than the oldest LIR page, most recent at
+ *		the top.  Stack pruning keeps an LIR page at the bottom, so a HIR
+ *		page found in S has a lower IRR than that page.
+ *	Q - resident HIR pages, in the order they will be evicted.
+ *
+ * Non-resident HIR pages are remembered by tag in ghost entries, which stay
+ * in S until they are pruned.  A page read in while its ghost entry is still
+ * in S becomes LIR, and the bottom LIR page of S is demoted to HIR in its
+ * place.  Ghost entries are also kept on list N in the order they were
+ * created, so the oldest one can be reused when they are all in use.
+ *
+ * Nodes are linked by int32 index into lirsNodes[], like the LRU stack in
+ * freelist_lru.c: entries 0 .. NBuffers - 1 belong to the buffers, entries
+ * NBuffers .. 2 * NBuffers - 1 are ghost entries, followed by the head and
+ * tail sentinels of S, Q and N.  A node can be on S and on one of Q and N at
+ * the same time, so it has a separate pair of links for each.
+ */
+#define LIRS_HIR_BUFFERS	Max(NBuffers / 100, 1)
+
+typedef struct LirsNode
+{
+	int32		sPrev;			/* links in stack S */
+	int32		sNext;
+	int32		qPrev;			/* links in queue Q or list N */
+	int32		qNext;
+	int			status;			/* LIRS_STATUS_xxx */
+} LirsNode;
+
+#define LIRS_NODE_NOT_IN_LIST	(-1)
+
+#define LIRS_STATUS_NONE		0	/* buffer not in use, or unused ghost entry */
+#define LIRS_STATUS_LIR			1
+#define LIRS_STATUS_HIR			2	/* resident HIR page, on Q */
+#define LIRS_STATUS_NONRESIDENT	3	/* ghost entry, on N and S */
+
+/* sentinel entries: top of S is head.next, front of Q and N is head.next */
+#define LIRS_S_HEAD		(2 * NBuffers)
+#define LIRS_S_TAIL		(2 * NBuffers + 1)
+#define LIRS_Q_HEAD		(2 * NBuffers + 2)
+#define LIRS_Q_TAIL		(2 * NBuffers + 3)
+#define LIRS_N_HEAD		(2 * NBuffers + 4)
+#define LIRS_N_TAIL		(2 * NBuffers + 5)
+
+#define LirsGhostNode(ghost)	(NBuffers + (ghost))
+#define LirsNodeGhost(node)	((node) - NBuffers)
+
+#define LIRS_NODES		(2 * NBuffers + 6)
+
+/*
+ * A ghost entry holds the tag of a non-resident HIR page.  Ghost entries are
+ * found by tag through a chained hash table, lirsGhostBuckets[]; hashNext
+ * also links the unused entries together.
+ */
+typedef struct LirsGhost
+{
+	BufferTag	tag;
+	int32		hashNext;
+} LirsGhost;
+
+#define LIRS_GHOST_NONE	(-1)
+
+static LirsNode *lirsNodes = NULL;
+static LirsGhost *lirsGhosts = NULL;
+static int32 *lirsGhostBuckets = NULL;
+
+/*
+ * Tag of the page bufmgr is about to read in, see StrategySetIncomingTag.
+ * Backend-private.
+ */
+static BufferTag lirsIncomingTag;
+static bool lirsHaveIncomingTag = false;
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects S, Q and N, the ghost entries and the fields
+	 * below.  When a buffer header spinlock is needed as well, lirs_lock is
+	 * always taken first.
+	 */
+	slock_t		lirs_lock;
+
+	int			lirCount;		/* number of LIR pages */
+	int32		firstFreeGhost; /* head of list of unused ghost entries */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+/*
+ * LirsStackRemove -- unlink node from S, if it is on it.
+ *
+ * Caller must hold lirs_lock.
+ */
+static inline void
+LirsStackRemove(int32 node)
+{
+	LirsNode   *curr = &lirsNodes[node];
+
+	if (curr->sPrev == LIRS_NODE_NOT_IN_LIST)
+		return;
+
+	lirsNodes[curr->sPrev].sNext = curr->sNext;
+	lirsNodes[curr->sNext].sPrev = curr->sPrev;
+	curr->sPrev = LIRS_NODE_NOT_IN_LIST;
+	curr->sNext = LIRS_NODE_NOT_IN_LIST;
+}
+
+/*
+ * LirsStackInsertAfter -- link node into S directly below node pos.
+ *
+ * Caller must hold lirs_lock, and the node must not be on S.
+ */
+static inline void
+LirsStackInsertAfter(int32 pos, int32 node)
+{
+	LirsNode   *curr = &lirsNodes[node];
+
+	curr->sPrev = pos;
+	curr->sNext = lirsNodes[pos].sNext;
+	lirsNodes[curr->sNext].sPrev = node;
+	lirsNodes[pos].sNext = node;
+}
+
+/*
+ * LirsStackPushTop -- move node to the top of S.
+ *
+ * Caller must hold lirs_lock.
+ */
+static inline void
+LirsStackPushTop(int32 node)
+{
+	LirsStackRemove(node);
+	LirsStackInsertAfter(LIRS_S_HEAD, node);
+}
+
+/*
+ * LirsQueueRemove -- unlink node from Q or N, if it is on either.
+ *
+ * Caller must hold lirs_lock.
+ */
+static inline void
+LirsQueueRemove(int32 node)
+{
+	LirsNode   *curr = &lirsNodes[node];
+
+	if (curr->qPrev == LIRS_NODE_NOT_IN_LIST)
+		return;
+
+	lirsNodes[curr->qPrev].qNext = curr->qNext;
+	lirsNodes[curr->qNext].qPrev = curr->qPrev;
+	curr->qPrev = LIRS_NODE_NOT_IN_LIST;
+	curr->qNext = LIRS_NODE_NOT_IN_LIST;
+}
+
+/*
+ * LirsQueuePushBack -- move node to the back of Q or N, given by the tail
+ *		sentinel.
+ *
+ * Caller must hold lirs_lock.
+ */
+static inline void
+LirsQueuePushBack(int32 tail, int32 node)
+{
+	LirsNode   *curr = &lirsNodes[node];
+
+	LirsQueueRemove(node);
+	curr->qNext = tail;
+	curr->qPrev = lirsNodes[tail].qPrev;
+	lirsNodes[curr->qPrev].qNext = node;
+	lirsNodes[tail].qPrev = node;
+}
+
+static inline int32 *
+LirsGhostBucket(BufferTag *tag)
+{
+	return &lirsGhostBuckets[BufTableHashCode(tag) % NBuffers];
+}
+
+/*
+ * LirsGhostLookup -- return the ghost entry remembering tag, or
+ *		LIRS_GHOST_NONE.
+ *
+ * Caller must hold lirs_lock.
+ */
+static int32
+LirsGhostLookup(BufferTag *tag)
+{
+	int32		ghost;
+
+	for (ghost = *LirsGhostBucket(tag);
+		 ghost != LIRS_GHOST_NONE;
+		 ghost = lirsGhosts[ghost].hashNext)
+	{
+		if (BufferTagsEqual(&lirsGhosts[ghost].tag, tag))
+			return ghost;
+	}
+
+	return LIRS_GHOST_NONE;
+}
+
+/*
+ * LirsGhostForget -- take a ghost entry off S and N and out of the hash
+ *		table, and make it available for reuse.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsGhostForget(int32 ghost)
+{
+	int32		node = LirsGhostNode(ghost);
+	int32	   *link = LirsGhostBucket(&lirsGhosts[ghost].tag);
+
+	while (*link != ghost)
+		link = &lirsGhosts[*link].hashNext;
+	*link = lirsGhosts[ghost].hashNext;
+
+	LirsStackRemove(node);
+	LirsQueueRemove(node);
+	lirsNodes[node].status = LIRS_STATUS_NONE;
+
+	lirsGhosts[ghost].hashNext = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = ghost;
+}
+
+/*
+ * LirsPruneStack -- remove HIR pages from the bottom of S until an LIR page
+ *		is at the bottom.  Ghost entries removed from S are forgotten, as a
+ *		page whose IRR is known to exceed that of every LIR page could never
+ *		become LIR on its next reference.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsPruneStack(void)
+{
+	int32		bottom;
+
+	while ((bottom = lirsNodes[LIRS_S_TAIL].sPrev) != LIRS_S_HEAD &&
+		   lirsNodes[bottom].status != LIRS_STATUS_LIR)
+	{
+		if (lirsNodes[bottom].status == LIRS_STATUS_NONRESIDENT)
+			LirsGhostForget(LirsNodeGhost(bottom));
+		else
+			LirsStackRemove(bottom);
+	}
+}
+
+/*
+ * LirsDemoteBottom -- make the LIR page at the bottom of S a resident HIR
+ *		page at the back of Q, to make room for a page that just became LIR.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsDemoteBottom(void)
+{
+	int32		bottom = lirsNodes[LIRS_S_TAIL].sPrev;
+
+	Assert(lirsNodes[bottom].status == LIRS_STATUS_LIR);
+
+	LirsStackRemove(bottom);
+	lirsNodes[bottom].status = LIRS_STATUS_HIR;
+	LirsQueuePushBack(LIRS_Q_TAIL, bottom);
+	StrategyControl->lirCount--;
+
+	LirsPruneStack();
+}
+
+/*
+ * LirsReplaceWithGhost -- the resident HIR page in buffer is being evicted;
+ *		if it is on S, leave a ghost entry remembering tag in its place.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsReplaceWithGhost(int buf_id, BufferTag *tag)
+{
+	int32		ghost;
+	int32		node;
+	int32	   *bucket;
+
+	if (lirsNodes[buf_id].sPrev == LIRS_NODE_NOT_IN_LIST)
+		return;
+
+	// all ghost entries in use: forget the oldest one
+	if (StrategyControl->firstFreeGhost == LIRS_GHOST_NONE)
+		LirsGhostForget(LirsNodeGhost(lirsNodes[LIRS_N_HEAD].qNext));
+
+	ghost = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = lirsGhosts[ghost].hashNext;
+
+	bucket = LirsGhostBucket(tag);
+	lirsGhosts[ghost].tag = *tag;
+	lirsGhosts[ghost].hashNext = *bucket;
+	*bucket = ghost;
+
+	node = LirsGhostNode(ghost);
+	lirsNodes[node].status = LIRS_STATUS_NONRESIDENT;
+	LirsStackInsertAfter(lirsNodes[buf_id].sPrev, node);
+	LirsQueuePushBack(LIRS_N_TAIL, node);
+}
+
+/*
+ * LirsRemoveBuffer -- take buffer off S and Q.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsRemoveBuffer(int buf_id)
+{
+	int			status = lirsNodes[buf_id].status;
+
+	LirsStackRemove(buf_id);
+	LirsQueueRemove(buf_id);
+	lirsNodes[buf_id].status = LIRS_STATUS_NONE;
+
+	if (status == LIRS_STATUS_LIR)
+	{
+		StrategyControl->lirCount--;
+		LirsPruneStack();
+	}
+}
+
+/*
+ * LirsLoadBuffer -- note that buffer is about to be (re)loaded with the
+ *		incoming page.
+ *
+ * The page previously held in the buffer, if any, leaves a ghost entry on S
+ * if it was a resident HIR page there.  The incoming page becomes LIR while
+ * the LIR set is not full yet or if its ghost entry is still on S, and a
+ * resident HIR page at the top of S and the back of Q otherwise.  The caller
+ * holds the buffer header spinlock, so buf->tag and buf_state still describe
+ * the previous page.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsLoadBuffer(BufferDesc *buf, uint32 buf_state)
+{
+	int			buf_id = buf->buf_id;
+	bool		ghost_hit = false;
+
+	// look the incoming page up first, its ghost entry might otherwise be reused
+	if (lirsHaveIncomingTag)
+	{
+		int32		ghost = LirsGhostLookup(&lirsIncomingTag);
+
+		if (ghost != LIRS_GHOST_NONE)
+		{
+			LirsGhostForget(ghost);
+			ghost_hit = true;
+		}
+	}
+
+	if (lirsNodes[buf_id].status == LIRS_STATUS_HIR && (buf_state & BM_TAG_VALID))
+		LirsReplaceWithGhost(buf_id, &buf->tag);
+	LirsRemoveBuffer(buf_id);
+
+	if (StrategyControl->lirCount < NBuffers - LIRS_HIR_BUFFERS || ghost_hit)
+	{
+		lirsNodes[buf_id].status = LIRS_STATUS_LIR;
+		LirsStackPushTop(buf_id);
+		if (StrategyControl->lirCount++ >= NBuffers - LIRS_HIR_BUFFERS)
+			LirsDemoteBottom();
+	}
+	else
+	{
+		lirsNodes[buf_id].status = LIRS_STATUS_HIR;
+		LirsStackPushTop(buf_id);
+		LirsQueuePushBack(LIRS_Q_TAIL, buf_id);
+	}
+}
+
+/*
+ * LirsReferenceBuffer -- note a further reference to a buffer that is
+ *		already loaded.
+ *
+ * Caller must hold lirs_lock.
+ */
+static void
+LirsReferenceBuffer(int buf_id)
+{
+	switch (lirsNodes[buf_id].status)
+	{
+		case LIRS_STATUS_LIR:
+			LirsStackPushTop(buf_id);
+			LirsPruneStack();
+			break;
+
+		case LIRS_STATUS_HIR:
+			if (lirsNodes[buf_id].sPrev != LIRS_NODE_NOT_IN_LIST)
+			{
+				// its IRR is now lower than that of the bottom LIR page
+				LirsStackPushTop(buf_id);
+				LirsQueueRemove(buf_id);
+				lirsNodes[buf_id].status = LIRS_STATUS_LIR;
+				StrategyControl->lirCount++;
+				LirsDemoteBottom();
+			}
+			else
+			{
+				LirsStackPushTop(buf_id);
+				LirsQueuePushBack(LIRS_Q_TAIL, buf_id);
+			}
+			break;
+
+		default:
+			// a buffer not in use is treated as freshly loaded
+			lirsNodes[buf_id].status = LIRS_STATUS_HIR;
+			LirsStackPushTop(buf_id);
+			LirsQueuePushBack(LIRS_Q_TAIL, buf_id);
+			break;
+	}
+}
+
+/*
+ * LirsGetVictim -- return the unpinned resident HIR page nearest the front
+ *		of Q, with its header spinlock held.  If every one of them is pinned,
+ *		fall back to the bottom-most unpinned LIR page of S.  Returns NULL if
+ *		every buffer is pinned.
+ *
+ * Caller must hold lirs_lock.
+ */
+static BufferDesc *
+LirsGetVictim(uint32 *buf_state)
+{
+	int32		victim;
+
+	for (victim = lirsNodes[LIRS_Q_HEAD].qNext;
+		 victim != LIRS_Q_TAIL;
+		 victim = lirsNodes[victim].qNext)
+	{
+		BufferDesc *buf = GetBufferDescriptor(victim);
+		uint32		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by LIRS, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+	}
+
+	for (victim = lirsNodes[LIRS_S_TAIL].sPrev;
+		 victim != LIRS_S_HEAD;
+		 victim = lirsNodes[victim].sPrev)
+	{
+		BufferDesc *buf;
+		uint32		local_buf_state;
+
+		if (lirsNodes[victim].status != LIRS_STATUS_LIR)
+			continue;
+
+		buf = GetBufferDescriptor(victim);
+		local_buf_state = LockBufHdr(buf);
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+	}
+
+	return NULL;
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The tag is looked up in the ghost entries on S.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	lirsHaveIncomingTag = (tag != NULL);
+	if (tag != NULL)
+		lirsIncomingTag = *tag;
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Moves buffer (identified by buf_id) to the top of the LIRS stack, changing its status if its IRR says so,
+// if delete is false; otherwise, delete buffer buf_id from the stack and queue.  A dropped page leaves no ghost entry.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	SpinLockAcquire(&StrategyControl->lirs_lock);
+
+	if (delete)
+		LirsRemoveBuffer(buf_id);
+	else
+		LirsReferenceBuffer(buf_id);
+
+	SpinLockRelease(&StrategyControl->lirs_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  lirs_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be reloaded while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->lirs_lock);
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			LirsLoadBuffer(buf, *buf_state);
+			SpinLockRelease(&StrategyControl->lirs_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->lirs_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For lirs implementation, usage_count is not important or ignored.
+			 */
+			SpinLockAcquire(&StrategyControl->lirs_lock);
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				LirsLoadBuffer(buf, local_buf_state);
+				SpinLockRelease(&StrategyControl->lirs_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->lirs_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run LIRS: evict the resident HIR page at
+	 * the front of Q.
+	 */
+	SpinLockAcquire(&StrategyControl->lirs_lock);
+
+	buf = LirsGetVictim(buf_state);
+	if (buf == NULL)
+	{
+		SpinLockRelease(&StrategyControl->lirs_lock);
+		elog(ERROR, "no unpinned buffers available");
+	}
+
+	if (strategy != NULL)
+		AddBufferToRing(strategy, buf);
+	LirsLoadBuffer(buf, *buf_state);
+
+	SpinLockRelease(&StrategyControl->lirs_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the LIRS stack and queue
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* size of the LIRS nodes, including ghost entries and sentinels */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LirsNode), LIRS_NODES)));
+
+	/* size of the ghost entries and their hash buckets */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LirsGhost), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int32), NBuffers)));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		lirs_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->lirs_lock);
+		StrategyControl->lirCount = 0;
+		StrategyControl->firstFreeGhost = 0;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+		Assert(!init);
+
+	/* Get or create the LIRS nodes and ghost entries, S, Q and N start empty */
+	lirsNodes = (LirsNode *)
+		ShmemInitStruct("LIRS nodes",
+						MAXALIGN(mul_size(sizeof(LirsNode), LIRS_NODES)),
+						&lirs_found);
+	lirsGhosts = (LirsGhost *)
+		ShmemInitStruct("LIRS ghost entries",
+						MAXALIGN(mul_size(sizeof(LirsGhost), NBuffers)),
+						&lirs_found);
+	lirsGhostBuckets = (int32 *)
+		ShmemInitStruct("LIRS ghost hash buckets",
+						MAXALIGN(mul_size(sizeof(int32), NBuffers)),
+						&lirs_found);
+
+	if (!lirs_found)
+	{
+		Assert(init);
+
+		for (int i = 0; i < LIRS_NODES; i++)
+		{
+			lirsNodes[i].sPrev = LIRS_NODE_NOT_IN_LIST;
+			lirsNodes[i].sNext = LIRS_NODE_NOT_IN_LIST;
+			lirsNodes[i].qPrev = LIRS_NODE_NOT_IN_LIST;
+			lirsNodes[i].qNext = LIRS_NODE_NOT_IN_LIST;
+			lirsNodes[i].status = LIRS_STATUS_NONE;
+		}
+
+		lirsNodes[LIRS_S_HEAD].sNext = LIRS_S_TAIL;
+		lirsNodes[LIRS_S_TAIL].sPrev = LIRS_S_HEAD;
+		lirsNodes[LIRS_Q_HEAD].qNext = LIRS_Q_TAIL;
+		lirsNodes[LIRS_Q_TAIL].qPrev = LIRS_Q_HEAD;
+		lirsNodes[LIRS_N_HEAD].qNext = LIRS_N_TAIL;
+		lirsNodes[LIRS_N_TAIL].qPrev = LIRS_N_HEAD;
+
+		// every ghost entry starts out unused
+		for (int i = 0; i < NBuffers; i++)
+		{
+			lirsGhosts[i].hashNext = (i + 1 < NBuffers) ? i + 1 : LIRS_GHOST_NONE;
+			lirsGhostBuckets[i] = LIRS_GHOST_NONE;
+		}
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
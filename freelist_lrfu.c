@@ -0,0 +1,1261 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+#include "utils/guc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * LRFU (Lee et al.) evicts the buffer with the smallest combined recency and
+ * frequency value (CRF).  Every reference to a page adds a weight to its CRF
+ * that decays as F(x) = 2^(-lambda * x) with the time x since the reference,
+ * so that
+ *
+ *	CRF(now) = 1 + 2^(-lambda * (now - last)) * CRF(last)
+ *
+ * for a reference at time now whose predecessor was at time last.  With
+ * lambda = 0 no reference ever decays and CRF is the reference count, LFU;
+ * with lambda = 1 the most recent reference outweighs all older ones put
+ * together, LRU.  Values in between blend recency and frequency, which
+ * suits workloads between pure OLTP and analytic reporting.
+ *
+ * Time is counted in buffer loads rather than references, so hits need not
+ * advance a shared clock.  Lambda is the lrfu.lambda setting, which can be
+ * changed with a reload.
+ */
+double		lrfu_lambda = 0.001;
+static bool lrfu_guc_defined = false;
+
+typedef struct LrfuBufferInfo
+{
+	double		crf;			/* CRF at lastTick */
+	uint64		lastTick;		/* time of the last applied reference */
+	double		key;			/* heap key, see LrfuKey */
+	int			heapPos;		/* position in lrfuHeap[], or -1 if the buffer
+								 * is not in use */
+
+	/*
+	 * References not yet applied to crf.  Hits only bump this counter,
+	 * without taking lrfu_lock; see LrfuApplyHits.
+	 */
+	pg_atomic_uint32 pendingHits;
+} LrfuBufferInfo;
+
+/*
+ * All buffers in use are kept in a binary min-heap, lrfuHeap[], ordered by
+ * a key that orders buffers by CRF at any common time now: as
+ *
+ *	log2(CRF(now)) = log2(crf) + lambda * lastTick - lambda * now
+ *
+ * the key is log2(crf) + lambda * lastTick, which does not change as time
+ * passes, so the heap need not be touched until a buffer is referenced.
+ * The preferred victim is at or near lrfuHeap[0].
+ *
+ * Pending hits only ever raise a key, so the heap order on the applied keys
+ * is a lower bound of the true order: a buffer without pending hits at the
+ * top of the heap really has the smallest CRF.  Hence pending hits are
+ * applied lazily, when LrfuGetVictim meets a buffer that has any, and all at
+ * once when it has to look at the whole heap anyway.  They are applied as if
+ * they all happened then, which overrates them a little.
+ */
+static LrfuBufferInfo *lrfuInfo = NULL;
+static int *lrfuHeap = NULL;
+
+/*
+ * Number of heap positions LrfuGetVictim examines before giving up on the
+ * heap order and falling back to a scan of the whole heap.  Only reached
+ * when that many buffers near the top of the heap are pinned or have
+ * pending hits.
+ */
+#define LRFU_MAX_CANDIDATES	64
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects lrfuInfo[] (except pendingHits), lrfuHeap[] and
+	 * the fields below.  When a buffer header spinlock is needed as well,
+	 * lrfu_lock is always taken first.
+	 */
+	slock_t		lrfu_lock;
+
+	uint64		tick;			/* current time, advanced on every load */
+	double		lambda;			/* lambda the heap keys were computed with */
+
+	int			heapSize;		/* number of buffers in lrfuHeap[] */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+/*
+ * LrfuBetterVictim -- is buffer a a better victim than buffer b?
+ */
+static inline bool
+LrfuBetterVictim(int a, int b)
+{
+	return lrfuInfo[a].key < lrfuInfo[b].key;
+}
+
+static inline void
+LrfuHeapSet(int pos, int buf_id)
+{
+	lrfuHeap[pos] = buf_id;
+	lrfuInfo[buf_id].heapPos = pos;
+}
+
+/*
+ * LrfuHeapSiftUp / LrfuHeapSiftDown -- restore the heap order around pos.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static void
+LrfuHeapSiftUp(int pos)
+{
+	int			buf_id = lrfuHeap[pos];
+
+	while (pos > 0)
+	{
+		int			parent = (pos - 1) / 2;
+
+		if (!LrfuBetterVictim(buf_id, lrfuHeap[parent]))
+			break;
+		LrfuHeapSet(pos, lrfuHeap[parent]);
+		pos = parent;
+	}
+	LrfuHeapSet(pos, buf_id);
+}
+
+static void
+LrfuHeapSiftDown(int pos)
+{
+	int			buf_id = lrfuHeap[pos];
+	int			size = StrategyControl->heapSize;
+
+	for (;;)
+	{
+		int			child = 2 * pos + 1;
+
+		if (child >= size)
+			break;
+		if (child + 1 < size && LrfuBetterVictim(lrfuHeap[child + 1], lrfuHeap[child]))
+			child++;
+		if (!LrfuBetterVictim(lrfuHeap[child], buf_id))
+			break;
+		LrfuHeapSet(pos, lrfuHeap[child]);
+		pos = child;
+	}
+	LrfuHeapSet(pos, buf_id);
+}
+
+/*
+ * LrfuHeapRemove -- take buffer out of the heap, if it is in it.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static void
+LrfuHeapRemove(int buf_id)
+{
+	int			pos = lrfuInfo[buf_id].heapPos;
+	int			last;
+
+	if (pos < 0)
+		return;
+
+	lrfuInfo[buf_id].heapPos = -1;
+	last = lrfuHeap[--StrategyControl->heapSize];
+	if (last == buf_id)
+		return;
+
+	LrfuHeapSet(pos, last);
+	LrfuHeapSiftUp(pos);
+	LrfuHeapSiftDown(lrfuInfo[last].heapPos);
+}
+
+/*
+ * LrfuKey -- heap key of a buffer with the given CRF at lastTick.
+ */
+static inline double
+LrfuKey(double crf, uint64 lastTick)
+{
+	return log2(crf) + StrategyControl->lambda * (double) lastTick;
+}
+
+/*
+ * LrfuReference -- apply hits references at the current time to the CRF and
+ *		the key of a buffer, without restoring the heap order.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static void
+LrfuReference(LrfuBufferInfo *info, uint32 hits)
+{
+	uint64		now = StrategyControl->tick;
+
+	info->crf = hits + exp2(-StrategyControl->lambda * (double) (now - info->lastTick)) * info->crf;
+	info->lastTick = now;
+	info->key = LrfuKey(info->crf, now);
+}
+
+/*
+ * LrfuApplyHits -- apply the pending hits of a buffer in the heap to its
+ *		CRF.  Returns false if there were none.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static bool
+LrfuApplyHits(int buf_id)
+{
+	LrfuBufferInfo *info = &lrfuInfo[buf_id];
+	uint32		hits = pg_atomic_exchange_u32(&info->pendingHits, 0);
+
+	if (hits == 0)
+		return false;
+
+	LrfuReference(info, hits);
+
+	// a reference only makes the buffer a worse victim
+	LrfuHeapSiftDown(info->heapPos);
+	return true;
+}
+
+/*
+ * LrfuApplyAllHits -- apply the pending hits of every buffer in the heap,
+ *		then restore the heap order in one pass.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static void
+LrfuApplyAllHits(void)
+{
+	for (int pos = 0; pos < StrategyControl->heapSize; pos++)
+	{
+		LrfuBufferInfo *info = &lrfuInfo[lrfuHeap[pos]];
+		uint32		hits = pg_atomic_exchange_u32(&info->pendingHits, 0);
+
+		if (hits > 0)
+			LrfuReference(info, hits);
+	}
+
+	for (int pos = StrategyControl->heapSize / 2 - 1; pos >= 0; pos--)
+		LrfuHeapSiftDown(pos);
+}
+
+/*
+ * LrfuSetLambda -- start using this backend's lrfu.lambda, if it differs
+ *		from the one the heap keys were computed with.
+ *
+ * Keys computed with different lambdas are not comparable, so all of them
+ * are recomputed and the heap is rebuilt.  Backends pick up a new setting
+ * at slightly different times after a reload, so this may happen a few
+ * times in a row, but not again until the setting changes.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static void
+LrfuSetLambda(void)
+{
+	if (lrfu_lambda == StrategyControl->lambda)
+		return;
+
+	StrategyControl->lambda = lrfu_lambda;
+
+	for (int pos = 0; pos < StrategyControl->heapSize; pos++)
+	{
+		LrfuBufferInfo *info = &lrfuInfo[lrfuHeap[pos]];
+
+		info->key = LrfuKey(info->crf, info->lastTick);
+	}
+
+	for (int pos = StrategyControl->heapSize / 2 - 1; pos >= 0; pos--)
+		LrfuHeapSiftDown(pos);
+}
+
+/*
+ * LrfuLoadBuffer -- note that buffer is about to be (re)loaded with a new
+ *		page, which counts as the first reference to that page and advances
+ *		the time.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static void
+LrfuLoadBuffer(BufferDesc *buf)
+{
+	LrfuBufferInfo *info = &lrfuInfo[buf->buf_id];
+
+	LrfuHeapRemove(buf->buf_id);
+
+	pg_atomic_write_u32(&info->pendingHits, 0);
+	info->crf = 1.0;
+	info->lastTick = ++StrategyControl->tick;
+	info->key = LrfuKey(info->crf, info->lastTick);
+
+	LrfuHeapSet(StrategyControl->heapSize++, buf->buf_id);
+	LrfuHeapSiftUp(info->heapPos);
+}
+
+/*
+ * LrfuScanVictim -- return the unpinned buffer with the smallest CRF in the
+ *		whole heap, with its header spinlock held, or NULL if every buffer is
+ *		pinned.
+ *
+ * Fallback for LrfuGetVictim, visiting every buffer in the heap.  All
+ * pending hits are applied first, so the keys compared are up to date.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static BufferDesc *
+LrfuScanVictim(uint32 *buf_state)
+{
+	int			best = -1;
+
+	LrfuApplyAllHits();
+
+	for (int pos = 0; pos < StrategyControl->heapSize; pos++)
+	{
+		int			buf_id = lrfuHeap[pos];
+
+		if (best >= 0 && !LrfuBetterVictim(buf_id, best))
+			continue;
+		if (BUF_STATE_GET_REFCOUNT(pg_atomic_read_u32(&GetBufferDescriptor(buf_id)->state)) == 0)
+			best = buf_id;
+	}
+
+	// recheck the pin count with the header locked
+	while (best >= 0)
+	{
+		BufferDesc *buf = GetBufferDescriptor(best);
+		uint32		local_buf_state = LockBufHdr(buf);
+
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+
+		// pinned after all, so settle for any unpinned buffer
+		best = -1;
+		for (int pos = 0; pos < StrategyControl->heapSize && best < 0; pos++)
+		{
+			if (BUF_STATE_GET_REFCOUNT(pg_atomic_read_u32(&GetBufferDescriptor(lrfuHeap[pos])->state)) == 0)
+				best = lrfuHeap[pos];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * LrfuGetVictim -- return the unpinned buffer with the smallest CRF, with its
+ *		header spinlock held, or NULL if every buffer is pinned.
+ *
+ * The heap is searched best-first: a position only becomes a candidate once
+ * its parent turned out to be pinned.  A candidate with pending hits has
+ * them applied, which moves it down the heap, and the search starts over
+ * from the top.
+ *
+ * Caller must hold lrfu_lock.
+ */
+static BufferDesc *
+LrfuGetVictim(uint32 *buf_state)
+{
+	int			candidates[LRFU_MAX_CANDIDATES];
+	int			ncandidates = 0;
+	int			examined = 0;
+
+	if (StrategyControl->heapSize > 0)
+		candidates[ncandidates++] = 0;
+
+	while (ncandidates > 0)
+	{
+		int			best = 0;
+		int			pos;
+		BufferDesc *buf;
+		uint32		local_buf_state;
+
+		if (++examined >= LRFU_MAX_CANDIDATES - 1)
+			return LrfuScanVictim(buf_state);
+
+		for (int i = 1; i < ncandidates; i++)
+		{
+			if (LrfuBetterVictim(lrfuHeap[candidates[i]], lrfuHeap[candidates[best]]))
+				best = i;
+		}
+		pos = candidates[best];
+		candidates[best] = candidates[--ncandidates];
+
+		if (LrfuApplyHits(lrfuHeap[pos]))
+		{
+			ncandidates = 0;
+			candidates[ncandidates++] = 0;
+			continue;
+		}
+
+		buf = GetBufferDescriptor(lrfuHeap[pos]);
+		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by LRFU, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+
+		for (int child = 2 * pos + 1; child <= 2 * pos + 2; child++)
+		{
+			if (child < StrategyControl->heapSize)
+				candidates[ncandidates++] = child;
+		}
+	}
+
+	return NULL;
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// LRFU does not depend on which page is read, so there is nothing to do.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Records a pending hit on buffer (identified by buf_id) if delete is false, which is applied to its
+// CRF the next time a victim is searched for; otherwise, delete buffer buf_id from the heap.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	if (!delete)
+	{
+		pg_atomic_fetch_add_u32(&lrfuInfo[buf_id].pendingHits, 1);
+		return;
+	}
+
+	SpinLockAcquire(&StrategyControl->lrfu_lock);
+	LrfuHeapRemove(buf_id);
+	pg_atomic_write_u32(&lrfuInfo[buf_id].pendingHits, 0);
+	SpinLockRelease(&StrategyControl->lrfu_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  lrfu_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be reloaded while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->lrfu_lock);
+		LrfuSetLambda();
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			LrfuLoadBuffer(buf);
+			SpinLockRelease(&StrategyControl->lrfu_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->lrfu_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For lrfu implementation, usage_count is not important or ignored.
+			 */
+			SpinLockAcquire(&StrategyControl->lrfu_lock);
+			LrfuSetLambda();
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				LrfuLoadBuffer(buf);
+				SpinLockRelease(&StrategyControl->lrfu_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->lrfu_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run LRFU: take the unpinned buffer with
+	 * the smallest CRF, found at or near the top of the heap.
+	 */
+	SpinLockAcquire(&StrategyControl->lrfu_lock);
+	LrfuSetLambda();
+
+	buf = LrfuGetVictim(buf_state);
+	if (buf == NULL)
+	{
+		SpinLockRelease(&StrategyControl->lrfu_lock);
+		elog(ERROR, "no unpinned buffers available");
+	}
+
+	if (strategy != NULL)
+		AddBufferToRing(strategy, buf);
+	LrfuLoadBuffer(buf);
+
+	SpinLockRelease(&StrategyControl->lrfu_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the heap
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* size of the per-buffer CRFs and of the heap */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LrfuBufferInfo), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int), NBuffers)));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		lrfu_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Define lrfu.lambda before the control block is set up, which takes its
+	 * initial value.  We can be called again, after a crash, in the same
+	 * process.
+	 */
+	if (!lrfu_guc_defined)
+	{
+		DefineCustomRealVariable("lrfu.lambda",
+								 "Sets the LRFU decay parameter.",
+								 "0 makes buffer replacement LFU, 1 makes it LRU.",
+								 &lrfu_lambda,
+								 0.001, 0.0, 1.0,
+								 PGC_SIGHUP,
+								 0,
+								 NULL, NULL, NULL);
+		MarkGUCPrefixReserved("lrfu");
+		lrfu_guc_defined = true;
+	}
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->lrfu_lock);
+		StrategyControl->tick = 0;
+		StrategyControl->lambda = lrfu_lambda;
+		StrategyControl->heapSize = 0;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+		Assert(!init);
+
+	/* Get or create the per-buffer CRFs and the heap */
+	lrfuInfo = (LrfuBufferInfo *)
+		ShmemInitStruct("LRFU buffer CRFs",
+						MAXALIGN(mul_size(sizeof(LrfuBufferInfo), NBuffers)),
+						&lrfu_found);
+	lrfuHeap = (int *)
+		ShmemInitStruct("LRFU heap",
+						MAXALIGN(mul_size(sizeof(int), NBuffers)),
+						&lrfu_found);
+
+	if (!lrfu_found)
+	{
+		Assert(init);
+
+		// the heap starts out empty, buffers enter it when first loaded
+		for (int i = 0; i < NBuffers; i++)
+		{
+			lrfuInfo[i].crf = 0.0;
+			lrfuInfo[i].lastTick = 0;
+			lrfuInfo[i].key = 0.0;
+			lrfuInfo[i].heapPos = -1;
+			pg_atomic_init_u32(&lrfuInfo[i].pendingHits, 0);
+		}
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
@@ -15,8 +15,10 @@
  */
 #include "postgres.h"
 
+#include "miscadmin.h"
 #include "pgstat.h"
 #include "port/atomics.h"
+#include "port/pg_bitutils.h"
 #include "storage/buf_internals.h"
 #include "storage/bufmgr.h"
 #include "storage/proc.h"
@@ -24,19 +26,162 @@
 #define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
 /*
  * A single buffer node structure, unit that forms doubly-'linked' list of buffers.
+ *
+ * Nodes are linked by index into lruStack[] rather than by pointer, which
+ * keeps a node at 8 bytes and stays valid however shared memory is mapped
+ * in each backend (EXEC_BACKEND).  Entries 0 .. NBuffers - 1 belong to the
+ * buffers with the same buf_id; each stack partition additionally owns a
+ * head and a tail sentinel entry after those, so that inserting and
+ * unlinking never has to special-case the top or bottom of a stack.
+ * A node that is not in any stack has prev == next == LRU_NODE_NOT_IN_STACK.
+ *
+ * Only unpinned buffers need to be in the stack, so that the victim search
+ * never has to walk past pinned ones.  Hits pin buffers on the hot path, so
+ * rather than unlinking a buffer when it is pinned, the victim search pops
+ * buffers off the bottom and leaves out any that turns out to be pinned, and
+ * LruUnpinBuffer links a buffer back in, at the position of its stamp,
+ * when it loses its last pin.  A pinned buffer is therefore passed over at
+ * most once per pin, and finding a victim takes amortized constant time
+ * however many buffers are pinned.
  */
  
 typedef struct BufferNode
 {
-	int node_id;
-	struct BufferNode *prev;
-	struct BufferNode *next;
-
+	int32		prev;
+	int32		next;
 } BufferNode;
 
+#define LRU_NODE_NOT_IN_STACK	(-1)
+
 // A stack of buffer nodes, traces the buffer node addresses.
 static BufferNode *lruStack = NULL;
 
+/*
+ * Stamp of each buffer, taken from StrategyControl->accessClock whenever the
+ * buffer is moved to the top of its stack, so that the bottoms of different
+ * stack partitions can be compared when looking for the least recently used
+ * buffer.  Kept apart from lruStack[] since only the victim loop reads it.
+ */
+static uint64 *lruStamps = NULL;
+
+/*
+ * The LRU stack is split into NUM_LRU_STACK_PARTITIONS independently locked
+ * stacks, so that buffer hits on different buffers do not all serialize on a
+ * single spinlock.  A buffer always lives in partition
+ * LruStackPartitionId(buf_id).  Each partition lock is padded to a cache
+ * line to avoid false sharing between them.
+ */
+#define NUM_LRU_STACK_PARTITIONS	16
+
+#define LruStackPartitionId(buf_id)	((buf_id) % NUM_LRU_STACK_PARTITIONS)
+#define LruStackPartitionLock(part) \
+	(&StrategyControl->stacks[(part)].stack_lock)
+
+/* sentinel entries of a stack partition: top is head.next, bottom tail.prev */
+#define LruStackHead(part)	(NBuffers + 2 * (part))
+#define LruStackTail(part)	(NBuffers + 2 * (part) + 1)
+
+#define LRU_STACK_NODES		(NBuffers + 2 * NUM_LRU_STACK_PARTITIONS)
+
+typedef union LruStackPadded
+{
+	slock_t		stack_lock;		/* protects the links of every node, and the
+								 * stamps of every buffer, in this stack */
+	char		pad[PG_CACHE_LINE_SIZE];
+} LruStackPadded;
+
+/*
+ * Backend-private batch of buffer hits not yet applied to the shared LRU
+ * stack.  Recording a hit here costs no lock at all; the batch is handed to
+ * the combiner when it fills up, or applied by this backend when it needs a
+ * victim buffer, which amortizes each lock acquisition over many hits (cf.
+ * BP-Wrapper).
+ */
+#define LRU_ACCESS_BATCH_SIZE	64
+
+static int	lruAccessBatch[LRU_ACCESS_BATCH_SIZE];
+static int	lruAccessBatchCount = 0;
+
+/*
+ * Flat combining of access batches.  A full batch is published in the
+ * backend's own slot in shared memory, and whichever backend holds
+ * combine_lock applies the published batches in one pass, taking each
+ * stack partition lock once for all of them (cf. Hendler et al., "Flat
+ * Combining and the Synchronization-Parallelism Tradeoff").  The combine
+ * lock is only tried, never waited for: if it is busy, the current combiner
+ * or the next one picks the batch up.  A backend whose slot
+ * is still waiting for a combiner when the next batch fills up drops that
+ * batch.  Hot buffers are hit again soon enough that losing a few moves to
+ * the top hardly changes the LRU order.
+ *
+ * Slots are indexed by pgprocno.  nrequests is set by the owner once
+ * requests[] is filled in, and cleared by the combiner once it has applied
+ * them; the owner does not touch requests[] while it is set.
+ */
+typedef struct LruCombineSlot
+{
+	pg_atomic_uint32 nrequests;
+	int			requests[LRU_ACCESS_BATCH_SIZE];
+} LruCombineSlot;
+
+#define LRU_COMBINE_SLOTS	(MaxBackends + NUM_AUXILIARY_PROCS)
+
+static LruCombineSlot *lruCombineSlots = NULL;
+
+/*
+ * A published slot is also marked in the lruCombinePublished bitmap, one
+ * bit per slot, and counted in combinePublished, so that the combiner only
+ * visits the words of the bitmap that have any, and stops once it has found
+ * them all, rather than reading the nrequests of every slot.
+ *
+ * A combiner takes at most LRU_COMBINE_MAX_BATCHES batches, which bounds
+ * both its pass and the number of accesses applied under one stack
+ * partition lock; batches published beyond that are left for the next
+ * combiner, which starts where this one stopped.
+ */
+#define LRU_COMBINE_MAX_BATCHES	8
+
+#define LRU_COMBINE_WORDS	((LRU_COMBINE_SLOTS + 63) / 64)
+
+static pg_atomic_uint64 *lruCombinePublished = NULL;
+
+/*
+ * An access taken by the combiner: the buffer, and the offset of its stamp
+ * in the block of stamps reserved for the pass.  The combiner buckets the
+ * requests it takes by stack partition, so that it reads each request once
+ * rather than once per partition.
+ */
+typedef struct LruCombineEntry
+{
+	int			buf_id;
+	uint32		offset;
+} LruCombineEntry;
+
+/*
+ * A buffer whose stamp is among the last NBuffers / LRU_HOT_FRACTION stamps
+ * handed out is in the hot head of the LRU order already, so a hit on it is
+ * not queued at all: the hottest buffers then cost no batch slot, stack lock
+ * or shared memory write (cf. the active list protection of Linux).  In
+ * pools smaller than LRU_HOT_MIN_BUFFERS that window would be a large part
+ * of the stack and noticeably reorder it, so they keep exact LRU.
+ */
+#define LRU_HOT_FRACTION		4
+#define LRU_HOT_MIN_BUFFERS		1024
+
+/* one attempt at taking the combine lock, true if we got it */
+#define LruCombineTryLock() \
+	(TAS_SPIN(&StrategyControl->combine_lock) == 0)
+
+/*
+ * Moves to the top applied and dropped by this backend, not yet added to
+ * the shared counters.
+ */
+static uint64 lruPromotionsApplied = 0;
+static uint64 lruPromotionsSkipped = 0;
+
+/* the shared counts are reported once every this many flushes */
+#define LRU_PROMOTION_REPORT_FLUSHES	4096
+
 /*
  * The shared freelist control information.
  */
@@ -56,11 +201,29 @@ typedef struct
 	int			lastFreeBuffer; /* Tail of list of unused buffers */
 	
 	
-	slock_t		stack_lock;
-	slock_t 	lru_lock;
-	// Pointer to the top and bottom nodes of the BufferNode stack.
-	BufferNode *stackTop;
-	BufferNode *stackBottom;
+	/* Source of lruStamps, advanced on every move to the top */
+	pg_atomic_uint64 accessClock;
+
+	LruStackPadded stacks[NUM_LRU_STACK_PARTITIONS];
+
+	/* Spinlock: held by the backend applying the combining slots */
+	slock_t		combine_lock;
+
+	/* Number of slots marked in lruCombinePublished, or a few more */
+	pg_atomic_uint32 combinePublished;
+
+	/* Word of lruCombinePublished to start the next pass at */
+	int			combineNextWord;	/* protected by combine_lock */
+
+	/*
+	 * Buffer hits applied to the LRU stack, and dropped because the
+	 * backend's combining slot was still occupied; see LruCombineSlot.
+	 * Reported at DEBUG1 by LruPublishPromotionCounts, which counts the
+	 * flushes of every backend in promotionFlushes.
+	 */
+	pg_atomic_uint64 promotionsApplied;
+	pg_atomic_uint64 promotionsSkipped;
+	pg_atomic_uint32 promotionFlushes;
 
 	/*
 	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
@@ -113,8 +276,11 @@ typedef struct BufferAccessStrategyData
 
 
 void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+extern void (*StrategyUnpinBuffer_hook) (int buf_id); /* cs3223 */
 
 /* Prototypes for internal functions */
+static void LruUnpinBuffer(int buf_id);
 static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
 									 uint32 *buf_state);
 static void AddBufferToRing(BufferAccessStrategy strategy,
@@ -203,120 +369,649 @@ have_free_buffer(void)
 }
 
 
+/*
+ * LruStackRemove -- unlink buffer from its stack partition, if it is linked.
+ *
+ * Caller must hold the partition's stack_lock.
+ */
+static inline void
+LruStackRemove(int buf_id)
+{
+	BufferNode *curr = &lruStack[buf_id];
+
+	// not in stack
+	if (curr->next == LRU_NODE_NOT_IN_STACK)
+		return;
+
+	lruStack[curr->prev].next = curr->next;
+	lruStack[curr->next].prev = curr->prev;
+
+	// remove links on node
+	curr->prev = LRU_NODE_NOT_IN_STACK;
+	curr->next = LRU_NODE_NOT_IN_STACK;
+}
+
+/*
+ * LruStackInsertAfter -- link buffer into the stack directly below node pos.
+ *
+ * Caller must hold the partition's stack_lock, and the buffer must not be in
+ * the stack.
+ */
+static inline void
+LruStackInsertAfter(int32 pos, int buf_id)
+{
+	BufferNode *curr = &lruStack[buf_id];
+
+	curr->prev = pos;
+	curr->next = lruStack[pos].next;
+	lruStack[curr->next].prev = buf_id;
+	lruStack[pos].next = buf_id;
+}
+
+/*
+ * LruStackPushTop -- move buffer to the top of its stack partition,
+ *		inserting it if it is not in the stack yet, and give it the given
+ *		stamp.
+ *
+ * Caller must hold the partition's stack_lock.  A stamp older than the
+ * current top's (possible when two backends apply access batches
+ * concurrently) is raised to the top's stamp, so each partition stays
+ * ordered by stamp from top to bottom.
+ */
+static inline void
+LruStackPushTop(int part, int buf_id, uint64 stamp)
+{
+	int32		head = LruStackHead(part);
+	int32		top = lruStack[head].next;
+
+	if (top != LruStackTail(part) && lruStamps[top] > stamp)
+		stamp = lruStamps[top];
+	lruStamps[buf_id] = stamp;
+
+	// node already at top, nothing to relink
+	if (top == buf_id)
+		return;
+
+	LruStackRemove(buf_id);
+	LruStackInsertAfter(head, buf_id);
+}
+
+/*
+ * LruStackInsertByStamp -- link buffer into its stack partition at the
+ *		position of the stamp it already has.
+ *
+ * This runs on the unpin path for every buffer that the victim search took
+ * out while it was pinned, so the walk is bounded by LRU_INSERT_MAX_WALK
+ * nodes.  It starts from whichever end of the stack has the closer stamp,
+ * and the common cases need no walk at all: such a buffer was the oldest in
+ * its partition when it was taken out, so it usually goes back at the
+ * bottom, or it was hit meanwhile and goes to the top.  If the walk does not
+ * reach the position, the buffer goes where the walk stopped and takes over
+ * the stamp of its neighbour towards the far end, so the partition stays
+ * ordered by stamp; that moves it at most LRU_INSERT_MAX_WALK places from
+ * either end.
+ *
+ * Caller must hold the partition's stack_lock, and the buffer must not be in
+ * the stack.
+ */
+#define LRU_INSERT_MAX_WALK		32
+
+static void
+LruStackInsertByStamp(int part, int buf_id)
+{
+	uint64		stamp = lruStamps[buf_id];
+	int32		top = lruStack[LruStackHead(part)].next;
+	int32		bottom = lruStack[LruStackTail(part)].prev;
+	int32		pos;
+	int			steps = 0;
+
+	if (top == LruStackTail(part) || stamp >= lruStamps[top])
+		pos = LruStackHead(part);
+	else if (stamp <= lruStamps[bottom])
+		pos = bottom;
+	else if (lruStamps[top] - stamp <= stamp - lruStamps[bottom])
+	{
+		// lruStamps[bottom] < stamp stops the walk before the tail sentinel
+		pos = top;
+		while (lruStamps[lruStack[pos].next] > stamp)
+		{
+			if (++steps >= LRU_INSERT_MAX_WALK)
+			{
+				lruStamps[buf_id] = lruStamps[lruStack[pos].next];
+				break;
+			}
+			pos = lruStack[pos].next;
+		}
+	}
+	else
+	{
+		// lruStamps[top] > stamp stops the walk before the head sentinel
+		pos = bottom;
+		while (lruStamps[lruStack[pos].prev] < stamp)
+		{
+			if (++steps >= LRU_INSERT_MAX_WALK)
+			{
+				lruStamps[buf_id] = lruStamps[lruStack[pos].prev];
+				break;
+			}
+			pos = lruStack[pos].prev;
+		}
+		pos = lruStack[pos].prev;
+	}
+
+	LruStackInsertAfter(pos, buf_id);
+}
+
+/*
+ * LruStackPopOldest -- unlink and return the least recently used buffer in
+ *		the stack, or -1 if every stack partition is empty.
+ *
+ * The global LRU order is the merge of the stack partitions by stamp, so the
+ * buffer to take is the bottom of the partition whose bottom has the oldest
+ * stamp.  The bottoms are compared without any lock, which at worst picks a
+ * slightly younger buffer while hits are being applied concurrently; only
+ * the chosen partition is locked, and only for the unlink itself.
+ */
+static int
+LruStackPopOldest(void)
+{
+	for (;;)
+	{
+		int			part = -1;
+		uint64		oldest = 0;
+		int32		victim;
+
+		for (int i = 0; i < NUM_LRU_STACK_PARTITIONS; i++)
+		{
+			int32		bottom = lruStack[LruStackTail(i)].prev;
+
+			if (bottom == LruStackHead(i))
+				continue;
+			if (part < 0 || lruStamps[bottom] < oldest)
+			{
+				part = i;
+				oldest = lruStamps[bottom];
+			}
+		}
+
+		// every partition is empty, all buffers are pinned
+		if (part < 0)
+			return -1;
+
+		SpinLockAcquire(LruStackPartitionLock(part));
+		victim = lruStack[LruStackTail(part)].prev;
+		if (victim != LruStackHead(part))
+			LruStackRemove(victim);
+		SpinLockRelease(LruStackPartitionLock(part));
+
+		// the partition was emptied meanwhile, look again
+		if (victim != LruStackHead(part))
+			return victim;
+	}
+}
+
+/*
+ * LruForgetPendingAccess -- drop this backend's pending accesses to buffer
+ *		from the batch, returning whether there were any.
+ */
+static bool
+LruForgetPendingAccess(int buf_id)
+{
+	int			kept = 0;
+
+	for (int i = 0; i < lruAccessBatchCount; i++)
+	{
+		if (lruAccessBatch[i] != buf_id)
+			lruAccessBatch[kept++] = lruAccessBatch[i];
+	}
+
+	if (kept == lruAccessBatchCount)
+		return false;
+
+	lruAccessBatchCount = kept;
+	return true;
+}
+
+/*
+ * LruPublishPromotionCounts -- add this backend's promotion counts to the
+ *		shared ones.
+ *
+ * Called at the end of every flush of the access batch.  Every
+ * LRU_PROMOTION_REPORT_FLUSHES flushes that applied or dropped any hits,
+ * counted over all backends, the backend making the flush logs the
+ * cumulative counts at DEBUG1.
+ */
+static void
+LruPublishPromotionCounts(void)
+{
+	uint32		flushes;
+
+	if (lruPromotionsApplied == 0 && lruPromotionsSkipped == 0)
+		return;
+
+	if (lruPromotionsApplied > 0)
+	{
+		pg_atomic_fetch_add_u64(&StrategyControl->promotionsApplied,
+								lruPromotionsApplied);
+		lruPromotionsApplied = 0;
+	}
+	if (lruPromotionsSkipped > 0)
+	{
+		pg_atomic_fetch_add_u64(&StrategyControl->promotionsSkipped,
+								lruPromotionsSkipped);
+		lruPromotionsSkipped = 0;
+	}
+
+	flushes = pg_atomic_add_fetch_u32(&StrategyControl->promotionFlushes, 1);
+	if (flushes % LRU_PROMOTION_REPORT_FLUSHES == 0)
+		elog(DEBUG1, "LRU promotions applied: " UINT64_FORMAT ", skipped: " UINT64_FORMAT,
+			 pg_atomic_read_u64(&StrategyControl->promotionsApplied),
+			 pg_atomic_read_u64(&StrategyControl->promotionsSkipped));
+}
+
+/*
+ * LruCountAccesses -- count accesses per stack partition.
+ *
+ * Adds the number of requests to partition part to partstart[part + 1],
+ * which the caller then turns into the start of each partition's bucket.
+ */
+static inline void
+LruCountAccesses(const int *requests, int nrequests, int *partstart)
+{
+	for (int i = 0; i < nrequests; i++)
+		partstart[LruStackPartitionId(requests[i]) + 1]++;
+}
+
+/*
+ * LruBucketAccesses -- copy accesses into the bucket of their partition.
+ *
+ * fill[part] is the next free entry of partition part's bucket; request i
+ * gets stamp offset offset + i.
+ */
+static inline void
+LruBucketAccesses(const int *requests, int nrequests, uint32 offset,
+				  LruCombineEntry *entries, int *fill)
+{
+	for (int i = 0; i < nrequests; i++)
+	{
+		LruCombineEntry *entry =
+			&entries[fill[LruStackPartitionId(requests[i])]++];
+
+		entry->buf_id = requests[i];
+		entry->offset = offset + i;
+	}
+}
+
+/*
+ * LruApplyAccesses -- apply accesses bucketed by stack partition.
+ *
+ * The accesses to partition part are entries[partstart[part]] up to
+ * entries[partstart[part + 1]], in stamp order, and get stamp base plus
+ * their offset.  Each partition lock is taken once, and only if the
+ * partition has accesses.  A buffer that is not in the stack only gets its
+ * stamp: it is pinned, or on the freelist, and LruUnpinBuffer links it
+ * in once it is evictable.
+ */
+static void
+LruApplyAccesses(const LruCombineEntry *entries, const int *partstart,
+				 uint64 base)
+{
+	for (int part = 0; part < NUM_LRU_STACK_PARTITIONS; part++)
+	{
+		if (partstart[part] == partstart[part + 1])
+			continue;
+
+		SpinLockAcquire(LruStackPartitionLock(part));
+		for (int i = partstart[part]; i < partstart[part + 1]; i++)
+		{
+			int			buf_id = entries[i].buf_id;
+			uint64		stamp = base + entries[i].offset;
+
+			if (lruStack[buf_id].next != LRU_NODE_NOT_IN_STACK)
+				LruStackPushTop(part, buf_id, stamp);
+			else
+				lruStamps[buf_id] = stamp;
+			lruPromotionsApplied++;
+		}
+		SpinLockRelease(LruStackPartitionLock(part));
+	}
+}
+
+/*
+ * LruCombine -- apply the access batches published in the combining slots
+ *		to the shared LRU stack.
+ *
+ * Takes up to LRU_COMBINE_MAX_BATCHES published slots, going through the
+ * bitmap from where the previous pass stopped, so that no slot waits for
+ * long however many are published.  A block of consecutive stamps is
+ * reserved for all the batches taken, so the accesses of each batch keep
+ * their relative order even though they are applied one stack partition at
+ * a time.  The requests are bucketed by partition before any partition
+ * lock is taken.
+ *
+ * Caller must hold combine_lock.
+ */
+static void
+LruCombine(void)
+{
+	LruCombineEntry entries[LRU_COMBINE_MAX_BATCHES * LRU_ACCESS_BATCH_SIZE];
+	LruCombineSlot *taken[LRU_COMBINE_MAX_BATCHES];
+	int			ntaken[LRU_COMBINE_MAX_BATCHES];
+	int			nbatches = 0;
+	int			maxbatches;
+	int			nwords = LRU_COMBINE_WORDS;
+	int			word = StrategyControl->combineNextWord;
+	int			partstart[NUM_LRU_STACK_PARTITIONS + 1] = {0};
+	int			fill[NUM_LRU_STACK_PARTITIONS];
+	uint32		offset = 0;
+	uint64		total = 0;
+
+	maxbatches = (int) pg_atomic_read_u32(&StrategyControl->combinePublished);
+	if (maxbatches == 0)
+		return;
+	maxbatches = Min(maxbatches, LRU_COMBINE_MAX_BATCHES);
+
+	// take published slots, a word of the bitmap at a time
+	for (int i = 0; i < nwords && nbatches < maxbatches; i++)
+	{
+		uint64		bits = pg_atomic_read_u64(&lruCombinePublished[word]);
+		uint64		picked = 0;
+
+		while (bits != 0 && nbatches < maxbatches)
+		{
+			int			bit = pg_rightmost_one_pos64(bits);
+
+			bits &= bits - 1;
+			picked |= UINT64CONST(1) << bit;
+			taken[nbatches++] = &lruCombineSlots[word * 64 + bit];
+		}
+
+		/* only the combiner clears bits, so this leaves the others set */
+		if (picked != 0)
+			pg_atomic_fetch_and_u64(&lruCombinePublished[word], ~picked);
+
+		// slots left over in this word come first in the next pass
+		if (bits != 0)
+			break;
+		word = (word + 1) % nwords;
+	}
+	StrategyControl->combineNextWord = word;
+
+	if (nbatches == 0)
+		return;
+	pg_atomic_fetch_sub_u32(&StrategyControl->combinePublished, nbatches);
+
+	/*
+	 * A slot is marked only after its count is set, and the atomic
+	 * operations above are full barriers, so the counts are there.
+	 */
+	for (int b = 0; b < nbatches; b++)
+	{
+		ntaken[b] = (int) pg_atomic_read_u32(&taken[b]->nrequests);
+		Assert(ntaken[b] > 0);
+		total += ntaken[b];
+	}
+
+	/* read the requests only after their counts, see LruFlushAccessBatch */
+	pg_read_barrier();
+
+	for (int b = 0; b < nbatches; b++)
+		LruCountAccesses(taken[b]->requests, ntaken[b], partstart);
+	for (int part = 0; part < NUM_LRU_STACK_PARTITIONS; part++)
+	{
+		partstart[part + 1] += partstart[part];
+		fill[part] = partstart[part];
+	}
+
+	for (int b = 0; b < nbatches; b++)
+	{
+		LruBucketAccesses(taken[b]->requests, ntaken[b], offset, entries, fill);
+		offset += ntaken[b];
+	}
+
+	/* done with requests[], hand the slots back to their owners */
+	pg_memory_barrier();
+
+	for (int b = 0; b < nbatches; b++)
+		pg_atomic_write_u32(&taken[b]->nrequests, 0);
+
+	LruApplyAccesses(entries, partstart,
+					 pg_atomic_fetch_add_u64(&StrategyControl->accessClock, total));
+}
+
+/*
+ * LruApplyAccessBatch -- apply this backend's pending accesses to the stack
+ *		itself, without the combiner.
+ *
+ * The batch is left empty.
+ */
+static void
+LruApplyAccessBatch(void)
+{
+	LruCombineEntry entries[LRU_ACCESS_BATCH_SIZE];
+	int			partstart[NUM_LRU_STACK_PARTITIONS + 1] = {0};
+	int			fill[NUM_LRU_STACK_PARTITIONS];
+
+	LruCountAccesses(lruAccessBatch, lruAccessBatchCount, partstart);
+	for (int part = 0; part < NUM_LRU_STACK_PARTITIONS; part++)
+	{
+		partstart[part + 1] += partstart[part];
+		fill[part] = partstart[part];
+	}
+	LruBucketAccesses(lruAccessBatch, lruAccessBatchCount, 0, entries, fill);
+
+	LruApplyAccesses(entries, partstart,
+					 pg_atomic_fetch_add_u64(&StrategyControl->accessClock,
+											 lruAccessBatchCount));
+	lruAccessBatchCount = 0;
+}
+
+/*
+ * LruFlushAccessBatch -- hand this backend's pending accesses to the
+ *		combiner.
+ *
+ * The batch is published in our combining slot, and applied right away if
+ * we get the combine lock.  With direct, which is for the allocation path,
+ * the batch is applied by ourselves instead, and the combine lock is only
+ * tried if our slot still holds an earlier batch.  The combine lock is never
+ * waited for: if another backend holds it, it or the next combiner applies
+ * what is published.  Either way the batch is left empty.
+ */
+static void
+LruFlushAccessBatch(bool direct)
+{
+	int			slotno;
+	LruCombineSlot *slot;
+
+	Assert(MyProc != NULL && MyProc->pgprocno < LRU_COMBINE_SLOTS);
+	slotno = MyProc->pgprocno;
+	slot = &lruCombineSlots[slotno];
+
+	if (direct)
+	{
+		if (lruAccessBatchCount > 0)
+			LruApplyAccessBatch();
+		if (pg_atomic_read_u32(&slot->nrequests) == 0)
+		{
+			LruPublishPromotionCounts();
+			return;
+		}
+	}
+	else if (lruAccessBatchCount > 0)
+	{
+		// our previous batch is still waiting for a combiner, try to be it
+		if (pg_atomic_read_u32(&slot->nrequests) != 0 && LruCombineTryLock())
+		{
+			LruCombine();
+			SpinLockRelease(&StrategyControl->combine_lock);
+		}
+
+		/* not combined yet, or not taken by a pass that had enough */
+		if (pg_atomic_read_u32(&slot->nrequests) != 0)
+		{
+			lruPromotionsSkipped += lruAccessBatchCount;
+			lruAccessBatchCount = 0;
+			LruPublishPromotionCounts();
+			return;
+		}
+
+		/*
+		 * Publish the batch.  The barrier makes sure a combiner that sees
+		 * the count also sees the requests.  The slot is counted before it
+		 * is marked, so that combinePublished never falls short of the
+		 * marked slots.
+		 */
+		memcpy(slot->requests, lruAccessBatch,
+			   lruAccessBatchCount * sizeof(int));
+		pg_write_barrier();
+		pg_atomic_write_u32(&slot->nrequests, lruAccessBatchCount);
+		pg_atomic_fetch_add_u32(&StrategyControl->combinePublished, 1);
+		pg_atomic_fetch_or_u64(&lruCombinePublished[slotno / 64],
+							   UINT64CONST(1) << (slotno % 64));
+		lruAccessBatchCount = 0;
+	}
+
+	if (LruCombineTryLock())
+	{
+		LruCombine();
+		SpinLockRelease(&StrategyControl->combine_lock);
+	}
+
+	LruPublishPromotionCounts();
+}
+
+/*
+ * LruBufferIsHot -- is the buffer in the hot head of the LRU order?
+ *
+ * Until the clock has handed out a full window of stamps, no buffer is hot.
+ * Every buffer starts out with stamp 0, and the clock only advances when
+ * hits are applied, so otherwise a fresh pool would take all its buffers
+ * for hot and never apply a hit.  After that, a buffer that was never
+ * stamped is old enough not to be.
+ *
+ * Reads the stamp without its stack lock, which at worst gets the answer
+ * wrong for a buffer being moved at the same moment.
+ */
+static inline bool
+LruBufferIsHot(int buf_id)
+{
+	uint64		clock;
+	uint64		window = (uint64) (NBuffers / LRU_HOT_FRACTION);
+
+	if (NBuffers < LRU_HOT_MIN_BUFFERS)
+		return false;
+
+	clock = pg_atomic_read_u64(&StrategyControl->accessClock);
+	if (clock < window)
+		return false;
+
+	return clock - lruStamps[buf_id] < window;
+}
+
 // cs3223
 // StrategyAccessBuffer 
 // Called by bufmgr when a buffer page is accessed.
 // Adjusts the position of buffer (identified by buf_id) in the LRU stack if delete is false;
 // otherwise, delete buffer buf_id from the LRU stack.
+// Accesses are only queued in this backend's batch and applied by a combiner; see
+// LruFlushAccessBatch.  Deletes are applied right away, under the partition lock.
 void
 StrategyAccessBuffer(int buf_id, bool delete)
 {
+	int			part;
 
-	SpinLockAcquire(&StrategyControl->stack_lock);
-	
 	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
-	{
-		SpinLockRelease(&StrategyControl->stack_lock);
 		elog(ERROR, "Invalid buffer index");
+
+	if (!delete)
+	{
+		if (LruBufferIsHot(buf_id))
+			return;
+
+		lruAccessBatch[lruAccessBatchCount++] = buf_id;
+		if (lruAccessBatchCount >= LRU_ACCESS_BATCH_SIZE)
+			LruFlushAccessBatch(false);
+		return;
 	}
-	
-	BufferNode *curr = &lruStack[buf_id]; // focus on the node with node_id = buf_id
-	
-	if (delete) // case 4: remove buffer(returned to freelist) from stack
-    	{
-    	
-		// not in stack or the only node in stack
-    		if (curr->prev == NULL && curr->next == NULL)
-		{	
-			// not in stack
-			if (StrategyControl->stackTop == NULL
-				|| StrategyControl->stackTop->node_id != buf_id)
-			{
-				SpinLockRelease(&StrategyControl->stack_lock);
-				return;
-			}
-			// only node in stack, stack is empty after this
-			else if (StrategyControl->stackTop->node_id == buf_id
-				&& StrategyControl->stackBottom->node_id == buf_id)
-			{
-				StrategyControl->stackTop = NULL;
-    				StrategyControl->stackBottom = NULL;
-			}
-			
-		}
-		// node at top    	
-        	else if (StrategyControl->stackTop->node_id == buf_id) 
-        	{
-            		StrategyControl->stackTop = curr->next;
-            		curr->next->prev = NULL;
-            		
-        	} 
-            	// node at bottom
-        	else if (StrategyControl->stackBottom->node_id == buf_id) 
-        	{	
-            		StrategyControl->stackBottom = curr->prev;
-            		curr->prev->next = NULL;
-        	}
-        	// node in the middle
-        	else
-        	{
-        		curr->next->prev = curr->prev;
-        		curr->prev->next = curr->next;
-        		
-        	}
-        	// remove links on node
-		curr->prev = NULL;
-		curr->next = NULL;
-        	
-        
-	} else 
+
+	/*
+	 * case 4: remove buffer(returned to freelist) from stack.  Drop any of
+	 * our own pending accesses to it first, so that a later flush does not
+	 * put it back.  Pending accesses of other backends may still do so, which
+	 * is harmless: the victim loop checks the buffer header anyway.
+	 */
+	LruForgetPendingAccess(buf_id);
+
+	part = LruStackPartitionId(buf_id);
+
+	SpinLockAcquire(LruStackPartitionLock(part));
+	LruStackRemove(buf_id);
+	SpinLockRelease(LruStackPartitionLock(part));
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The LRU stack does not depend on which page is read, so there is nothing to do.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+}
+
+// cs3223
+// LruUnpinBuffer
+// Called by bufmgr when buffer buf_id loses its last pin, as StrategyUnpinBuffer_hook.
+// Links the buffer back into the LRU stack if the victim search took it out while it
+// was pinned.  If this backend has a pending access to it, that access is applied now,
+// since the stack lock is taken anyway; this also puts a newly loaded page at the top.
+static void
+LruUnpinBuffer(int buf_id)
+{
+	BufferDesc *buf;
+	int			part;
+	uint32		buf_state;
+
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	/*
+	 * Still in the stack, nothing to do.  This unlocked check cannot miss an
+	 * unlink by the victim search that leaves the buffer out: the victim
+	 * search unlinks the buffer before locking its header and finding it
+	 * pinned, and our unpin had to wait for that header lock.  If the victim
+	 * search locks the header after our unpin instead, it takes the buffer.
+	 */
+	if (lruStack[buf_id].next != LRU_NODE_NOT_IN_STACK)
+		return;
+
+	buf = GetBufferDescriptor(buf_id);
+	part = LruStackPartitionId(buf_id);
+
+	SpinLockAcquire(LruStackPartitionLock(part));
+
+	/*
+	 * Recheck under the lock.  The buffer may have been pinned again, in
+	 * which case its next unpin links it in, or put on the freelist, which
+	 * the freelist path hands out without the stack; and another backend may
+	 * have linked it in already.
+	 */
+	buf_state = pg_atomic_read_u32(&buf->state);
+	if (BUF_STATE_GET_REFCOUNT(buf_state) == 0 &&
+		buf->freeNext == FREENEXT_NOT_IN_LIST &&
+		lruStack[buf_id].next == LRU_NODE_NOT_IN_STACK)
 	{
-		// c2: node not in stack, insert node at top
-		if (curr->prev == NULL && curr->next == NULL
-			&& (StrategyControl->stackTop == NULL
-				|| StrategyControl->stackTop->node_id != buf_id))
-		{	
-			// stack is empty, node is also bottom
-			if (StrategyControl->stackTop == NULL)
-			{
-				StrategyControl->stackBottom = curr;
-				
-			} else  
-			{
-				StrategyControl->stackTop->prev = curr;
-				curr->next = StrategyControl->stackTop;
-			}
-			// set node as top
-			StrategyControl->stackTop = curr;
-			
-		}
-		// c1/c3: node in stack, but not at top, move node to top
-		else if (StrategyControl->stackTop->node_id != buf_id)
-		{	
-			// node at bottom, set prev_node as new bottom
-			if (StrategyControl->stackBottom->node_id == buf_id)
-			{
-				StrategyControl->stackBottom = curr->prev;
-				curr->prev->next = NULL;
-				
-			} else // node in the middle
-			{
-				curr->next->prev = curr->prev;
-				curr->prev->next = curr->next;
-				
-			}
-			// set node as top
-			curr->next = StrategyControl->stackTop;
-			curr->prev = NULL;
-			StrategyControl->stackTop->prev = curr;
-			StrategyControl->stackTop = curr;
-			
+		if (LruForgetPendingAccess(buf_id))
+		{
+			LruStackPushTop(part, buf_id,
+							pg_atomic_fetch_add_u64(&StrategyControl->accessClock, 1));
+			lruPromotionsApplied++;
 		}
-	
+		else
+			LruStackInsertByStamp(part, buf_id);
 	}
-	
-	SpinLockRelease(&StrategyControl->stack_lock);
 
+	SpinLockRelease(LruStackPartitionLock(part));
 }
 
 /*
@@ -336,11 +1031,21 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_r
 {
 	BufferDesc *buf;
 	int			bgwprocno;
-	int			trycounter;
 	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
 
 	*from_ring = false;
 
+	/*
+	 * Apply our pending buffer hits first, so that the victim is chosen
+	 * from a stack that has them.  We apply them ourselves rather than wait
+	 * for the combine lock; batches still published in combining slots are
+	 * left to the combiner if another backend holds it.  This also leaves
+	 * the batch empty, so the StrategyAccessBuffer calls below, made while
+	 * holding a buffer header spinlock, only queue the access and never
+	 * take a stack lock.
+	 */
+	LruFlushAccessBatch(true);
+
 	/*
 	 * If given a strategy object, see whether it can select a buffer. We
 	 * assume strategy objects don't need buffer_strategy_lock.
@@ -453,20 +1158,25 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_r
 		}
 	}
 
-	/* Nothing on the freelist, so run LRU */
-	SpinLockAcquire(&StrategyControl->lru_lock);
-	// Get victim buffer from the tail of list, which means the bottom of the stack.
-	BufferNode *victim = StrategyControl->stackBottom;
-	
-	while(victim != NULL) {
-		buf = GetBufferDescriptor(victim->node_id);
+	/*
+	 * Nothing on the freelist, so run LRU: pop the least recently used buffer
+	 * off the stack and check it.  No stack lock is held while the buffer
+	 * header is locked.  A pinned buffer is left out of the stack until it is
+	 * unpinned; the victim is left out too, since the caller pins it, and its
+	 * access is only queued, so that LruUnpinBuffer puts it at the top.
+	 */
+	for (;;)
+	{
+		int			victim = LruStackPopOldest();
+
+		if (victim < 0)
+			elog(ERROR, "No unpinned buffer");
+
+		buf = GetBufferDescriptor(victim);
 
 		/*
-		 * If the buffer is pinned or has a nonzero usage_count, we cannot
-		 * use it; discard it and retry.  (This can only happen if VACUUM
-		 * put a valid buffer in the freelist and then someone else used
-		 * it before we got to it.  It's probably impossible altogether as
-		 * of 8.3, but we'd better check anyway.)
+		 * If the buffer is pinned, we cannot use it; retry with the next
+		 * least recently used buffer.
 		 *
 		 * For lru implementation, usage_count is not important or ignored.
 		 */
@@ -477,23 +1187,12 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_r
 				AddBufferToRing(strategy, buf);
 			StrategyAccessBuffer(buf->buf_id, false);
 			*buf_state = local_buf_state;
-			SpinLockRelease(&StrategyControl->lru_lock);
 			return buf;
-			
-		}
-		else if (StrategyControl->stackTop->node_id == buf->buf_id) 
-		{
-			UnlockBufHdr(buf, local_buf_state);
-			SpinLockRelease(&StrategyControl->lru_lock);
-			elog(ERROR, "No unpinned buffer");
 		}
-		
 		UnlockBufHdr(buf, local_buf_state);
-		
-		victim = victim->prev;
-        }
-        
-        SpinLockRelease(&StrategyControl->lru_lock);
+	}
+
+	return NULL;				/* keep compiler quiet */
 }
 
 /*
@@ -602,8 +1301,17 @@ StrategyShmemSize(void)
 	/* size of the shared replacement strategy control block */
 	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
 
-	/* size of the lruStack */
-	size = add_size(size, MAXALIGN(mul_size(sizeof(BufferNode), NBuffers)));
+	/* size of the lruStack, including the sentinels of every partition */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(BufferNode), LRU_STACK_NODES)));
+
+	/* size of the lruStamps */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(uint64), NBuffers)));
+
+	/* size of the combining slots, one per backend */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LruCombineSlot), LRU_COMBINE_SLOTS)));
+
+	/* size of the bitmap of published combining slots */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(pg_atomic_uint64), LRU_COMBINE_WORDS)));
 
 	return size;
 }
@@ -657,13 +1365,15 @@ StrategyInitialize(bool init)
 		StrategyControl->firstFreeBuffer = 0;
 		StrategyControl->lastFreeBuffer = NBuffers - 1;
 		
-		// Init lock
-		SpinLockInit(&StrategyControl->stack_lock);
-		SpinLockInit(&StrategyControl->lru_lock);
-		
-		// The top and bottom pointers of the stack is NULL during initialization.
-		StrategyControl->stackTop = NULL;
-                StrategyControl->stackBottom = NULL;
+		for (int i = 0; i < NUM_LRU_STACK_PARTITIONS; i++)
+			SpinLockInit(LruStackPartitionLock(i));
+		SpinLockInit(&StrategyControl->combine_lock);
+		pg_atomic_init_u32(&StrategyControl->combinePublished, 0);
+		StrategyControl->combineNextWord = 0;
+		pg_atomic_init_u64(&StrategyControl->accessClock, 0);
+		pg_atomic_init_u64(&StrategyControl->promotionsApplied, 0);
+		pg_atomic_init_u64(&StrategyControl->promotionsSkipped, 0);
+		pg_atomic_init_u32(&StrategyControl->promotionFlushes, 0);
 
 		/* Initialize the clock sweep pointer */
 		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
@@ -680,23 +1390,44 @@ StrategyInitialize(bool init)
 	else
 		Assert(!init);
 		
-	// Initialize LRU stack with NBuffers nodes.
+	// Initialize LRU stack with NBuffers nodes, plus the sentinels of every partition.
 	lruStack = (BufferNode*)ShmemInitStruct(
-		    "LRU stack", MAXALIGN(mul_size(sizeof(BufferNode), NBuffers)), &stack_found);
+		    "LRU stack", MAXALIGN(mul_size(sizeof(BufferNode), LRU_STACK_NODES)), &stack_found);
+	lruStamps = (uint64 *) ShmemInitStruct(
+		    "LRU stack stamps", MAXALIGN(mul_size(sizeof(uint64), NBuffers)), &stack_found);
+	lruCombineSlots = (LruCombineSlot *) ShmemInitStruct(
+		    "LRU combining slots", MAXALIGN(mul_size(sizeof(LruCombineSlot), LRU_COMBINE_SLOTS)), &stack_found);
+	lruCombinePublished = (pg_atomic_uint64 *) ShmemInitStruct(
+		    "LRU combining bitmap", MAXALIGN(mul_size(sizeof(pg_atomic_uint64), LRU_COMBINE_WORDS)), &stack_found);
 		
 	if (!stack_found) {
 		
 		for (int i = 0; i < NBuffers; i++) {
                     BufferNode *new_node = &lruStack[i];
-                    new_node->node_id = i;
-                    new_node->prev = NULL;
-                    new_node->next = NULL;
+                    new_node->prev = LRU_NODE_NOT_IN_STACK;
+                    new_node->next = LRU_NODE_NOT_IN_STACK;
+                    lruStamps[i] = 0;
                 }
+
+		// Every partition starts out empty, its head and tail linked to each other.
+		for (int i = 0; i < NUM_LRU_STACK_PARTITIONS; i++) {
+                    lruStack[LruStackHead(i)].prev = LRU_NODE_NOT_IN_STACK;
+                    lruStack[LruStackHead(i)].next = LruStackTail(i);
+                    lruStack[LruStackTail(i)].prev = LruStackHead(i);
+                    lruStack[LruStackTail(i)].next = LRU_NODE_NOT_IN_STACK;
+                }
+
+		for (int i = 0; i < LRU_COMBINE_SLOTS; i++)
+                    pg_atomic_init_u32(&lruCombineSlots[i].nrequests, 0);
+		for (int i = 0; i < LRU_COMBINE_WORDS; i++)
+                    pg_atomic_init_u64(&lruCombinePublished[i], 0);
              	
         }
         else 
         	Assert(!init);
-	
+
+	/* cs3223 - relink buffers that lose their last pin, see LruUnpinBuffer */
+	StrategyUnpinBuffer_hook = LruUnpinBuffer;
 }
 
 
@@ -0,0 +1,1297 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+#include "utils/guc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * LRU-K evicts the buffer whose K-th most recent reference is the oldest
+ * (the largest backward K-distance).  Buffers with fewer than K references
+ * have an infinite backward K-distance and go first, least recently used
+ * first among them.  With K = 2 and no retained history (see below) this
+ * is the ELRU policy of freelist_elru.c; larger values weigh reference
+ * frequency more heavily.
+ *
+ * K is the lruk.k setting.  The reference arrays below are sized from it, so
+ * it is read once, when shared memory is sized, and a change only takes
+ * effect at server start; see LrukReadK.
+ */
+#define LRUK_DEFAULT_K		2
+#define LRUK_MAX_K			16
+
+/* K in use, see StrategyShmemSize and StrategyInitialize */
+static int	lrukK = LRUK_DEFAULT_K;
+
+/*
+ * Reference history of a buffer: LrukBufferRefs(buf_id)[0] is the most
+ * recent reference, [K - 1] the K-th most recent one, 0 meaning there is no
+ * such reference.  Stamps come from StrategyControl->accessClock.
+ */
+typedef struct LrukBufferInfo
+{
+	int			heapPos;		/* position in lrukHeap[], or -1 if the buffer
+								 * is not in use */
+} LrukBufferInfo;
+
+/*
+ * All buffers in use are kept in a binary min-heap, lrukHeap[], ordered by
+ * LrukBetterVictim(), so the preferred victim is always at lrukHeap[0].
+ */
+static LrukBufferInfo *lrukInfo = NULL;
+static uint64 *lrukRefs = NULL;	/* K references per buffer */
+static int *lrukHeap = NULL;
+
+#define LrukBufferRefs(buf_id)	(&lrukRefs[(Size) (buf_id) * lrukK])
+
+/*
+ * Without retained history a page that is evicted and read again soon starts
+ * over with a single reference, and LRU-K degrades to LRU whenever the
+ * working set is larger than the buffer pool.  So the references of evicted
+ * pages are kept in a bounded history table keyed by BufferTag.  The table
+ * is set-associative: a tag can only be stored in one of LRUK_HISTORY_WAYS
+ * entries chosen by its hash, and when they are all used the entry with the
+ * oldest most recent reference is overwritten, so lookups and inserts are
+ * constant time.  It holds about as many pages as the buffer pool itself.
+ */
+#define LRUK_HISTORY_WAYS	4
+#define LRUK_HISTORY_SETS	Max(NBuffers / LRUK_HISTORY_WAYS, 1)
+
+typedef struct LrukHistoryEntry
+{
+	BufferTag	tag;
+	bool		valid;
+} LrukHistoryEntry;
+
+static LrukHistoryEntry *lrukHistory = NULL;
+static uint64 *lrukHistoryRefs = NULL;	/* K references per entry */
+
+#define LrukHistoryEntryRefs(entry) \
+	(&lrukHistoryRefs[(Size) ((entry) - lrukHistory) * lrukK])
+
+/*
+ * Tag of the page bufmgr is about to read in, see StrategySetIncomingTag.
+ * Backend-private.
+ */
+static BufferTag lrukIncomingTag;
+static bool lrukHaveIncomingTag = false;
+
+/*
+ * Number of heap positions LrukGetVictim examines before giving up on the
+ * heap order and falling back to a scan of the whole heap.  Only reached
+ * when that many buffers near the top of the heap are pinned.
+ */
+#define LRUK_MAX_CANDIDATES	64
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects lrukInfo[], lrukHeap[], lrukHistory[] and the
+	 * fields below.  When a buffer header spinlock is needed as well,
+	 * lruk_lock is always taken first.
+	 */
+	slock_t		lruk_lock;
+
+	/* Source of reference stamps, advanced on every reference */
+	uint64		accessClock;
+
+	int			k;				/* K the arrays were sized for */
+
+	int			heapSize;		/* number of buffers in lrukHeap[] */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+/*
+ * LrukBetterVictim -- is buffer a a better victim than buffer b?
+ *
+ * Compares the K-th most recent references, which are 0 for buffers with
+ * fewer than K references, and breaks ties by the most recent reference.
+ */
+static inline bool
+LrukBetterVictim(int a, int b)
+{
+	uint64	   *ra = LrukBufferRefs(a);
+	uint64	   *rb = LrukBufferRefs(b);
+
+	if (ra[lrukK - 1] != rb[lrukK - 1])
+		return ra[lrukK - 1] < rb[lrukK - 1];
+	return ra[0] < rb[0];
+}
+
+static inline void
+LrukHeapSet(int pos, int buf_id)
+{
+	lrukHeap[pos] = buf_id;
+	lrukInfo[buf_id].heapPos = pos;
+}
+
+/*
+ * LrukHeapSiftUp / LrukHeapSiftDown -- restore the heap order around pos.
+ *
+ * Caller must hold lruk_lock.
+ */
+static void
+LrukHeapSiftUp(int pos)
+{
+	int			buf_id = lrukHeap[pos];
+
+	while (pos > 0)
+	{
+		int			parent = (pos - 1) / 2;
+
+		if (!LrukBetterVictim(buf_id, lrukHeap[parent]))
+			break;
+		LrukHeapSet(pos, lrukHeap[parent]);
+		pos = parent;
+	}
+	LrukHeapSet(pos, buf_id);
+}
+
+static void
+LrukHeapSiftDown(int pos)
+{
+	int			buf_id = lrukHeap[pos];
+	int			size = StrategyControl->heapSize;
+
+	for (;;)
+	{
+		int			child = 2 * pos + 1;
+
+		if (child >= size)
+			break;
+		if (child + 1 < size && LrukBetterVictim(lrukHeap[child + 1], lrukHeap[child]))
+			child++;
+		if (!LrukBetterVictim(lrukHeap[child], buf_id))
+			break;
+		LrukHeapSet(pos, lrukHeap[child]);
+		pos = child;
+	}
+	LrukHeapSet(pos, buf_id);
+}
+
+/*
+ * LrukHeapRemove -- take buffer out of the heap, if it is in it.
+ *
+ * Caller must hold lruk_lock.
+ */
+static void
+LrukHeapRemove(int buf_id)
+{
+	int			pos = lrukInfo[buf_id].heapPos;
+	int			last;
+
+	if (pos < 0)
+		return;
+
+	lrukInfo[buf_id].heapPos = -1;
+	last = lrukHeap[--StrategyControl->heapSize];
+	if (last == buf_id)
+		return;
+
+	LrukHeapSet(pos, last);
+	LrukHeapSiftUp(pos);
+	LrukHeapSiftDown(lrukInfo[last].heapPos);
+}
+
+/*
+ * LrukHistorySet -- return the first of the LRUK_HISTORY_WAYS history entries
+ *		a tag can be stored in.
+ */
+static inline LrukHistoryEntry *
+LrukHistorySet(BufferTag *tag)
+{
+	uint32		hashcode = BufTableHashCode(tag);
+
+	return &lrukHistory[(hashcode % LRUK_HISTORY_SETS) * LRUK_HISTORY_WAYS];
+}
+
+/*
+ * LrukHistoryRemember -- retain the references of a page that is evicted.
+ *
+ * Caller must hold lruk_lock.
+ */
+static void
+LrukHistoryRemember(BufferTag *tag, uint64 *refs)
+{
+	LrukHistoryEntry *set = LrukHistorySet(tag);
+	LrukHistoryEntry *entry = &set[0];
+
+	for (int i = 0; i < LRUK_HISTORY_WAYS; i++)
+	{
+		if (!set[i].valid || BufferTagsEqual(&set[i].tag, tag))
+		{
+			entry = &set[i];
+			break;
+		}
+		if (LrukHistoryEntryRefs(&set[i])[0] < LrukHistoryEntryRefs(entry)[0])
+			entry = &set[i];
+	}
+
+	entry->tag = *tag;
+	entry->valid = true;
+	memcpy(LrukHistoryEntryRefs(entry), refs, lrukK * sizeof(uint64));
+}
+
+/*
+ * LrukHistoryForget -- look up the retained references of a page and remove
+ *		them from the history table.  Returns false if there are none.
+ *
+ * Caller must hold lruk_lock.
+ */
+static bool
+LrukHistoryForget(BufferTag *tag, uint64 *refs)
+{
+	LrukHistoryEntry *set = LrukHistorySet(tag);
+
+	for (int i = 0; i < LRUK_HISTORY_WAYS; i++)
+	{
+		if (set[i].valid && BufferTagsEqual(&set[i].tag, tag))
+		{
+			memcpy(refs, LrukHistoryEntryRefs(&set[i]), lrukK * sizeof(uint64));
+			set[i].valid = false;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * LrukReferenceBuffer -- record a new reference to the page in buffer.
+ *
+ * Caller must hold lruk_lock.
+ */
+static void
+LrukReferenceBuffer(int buf_id)
+{
+	LrukBufferInfo *info = &lrukInfo[buf_id];
+	uint64	   *refs = LrukBufferRefs(buf_id);
+
+	memmove(&refs[1], &refs[0], (lrukK - 1) * sizeof(uint64));
+	refs[0] = ++StrategyControl->accessClock;
+
+	// a reference only makes the buffer a worse victim
+	if (info->heapPos >= 0)
+		LrukHeapSiftDown(info->heapPos);
+	else
+	{
+		LrukHeapSet(StrategyControl->heapSize++, buf_id);
+		LrukHeapSiftUp(info->heapPos);
+	}
+}
+
+/*
+ * LrukLoadBuffer -- note that buffer is about to be (re)loaded with a new
+ *		page, which counts as the first reference to that page in the buffer.
+ *
+ * The references of the page previously held in the buffer, if any, are
+ * moved to the history table, and those retained for the incoming page, if
+ * any, are taken from it.  The caller holds the buffer header spinlock, so
+ * buf->tag and buf_state still describe the previous page.
+ *
+ * Caller must hold lruk_lock.
+ */
+static void
+LrukLoadBuffer(BufferDesc *buf, uint32 buf_state)
+{
+	LrukBufferInfo *info = &lrukInfo[buf->buf_id];
+	uint64	   *refs = LrukBufferRefs(buf->buf_id);
+
+	if (info->heapPos >= 0 && (buf_state & BM_TAG_VALID))
+		LrukHistoryRemember(&buf->tag, refs);
+
+	LrukHeapRemove(buf->buf_id);
+
+	if (!lrukHaveIncomingTag || !LrukHistoryForget(&lrukIncomingTag, refs))
+		memset(refs, 0, lrukK * sizeof(uint64));
+
+	LrukReferenceBuffer(buf->buf_id);
+}
+
+/*
+ * LrukScanVictim -- return the best unpinned buffer of the whole heap, with
+ *		its header spinlock held, or NULL if every buffer is pinned.
+ *
+ * Fallback for LrukGetVictim, visiting every buffer in the heap.
+ *
+ * Caller must hold lruk_lock.
+ */
+static BufferDesc *
+LrukScanVictim(uint32 *buf_state)
+{
+	int			best = -1;
+
+	for (int pos = 0; pos < StrategyControl->heapSize; pos++)
+	{
+		int			buf_id = lrukHeap[pos];
+
+		if (best >= 0 && !LrukBetterVictim(buf_id, best))
+			continue;
+		if (BUF_STATE_GET_REFCOUNT(pg_atomic_read_u32(&GetBufferDescriptor(buf_id)->state)) == 0)
+			best = buf_id;
+	}
+
+	// recheck the pin count with the header locked
+	while (best >= 0)
+	{
+		BufferDesc *buf = GetBufferDescriptor(best);
+		uint32		local_buf_state = LockBufHdr(buf);
+
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+
+		// pinned after all, so settle for any unpinned buffer
+		best = -1;
+		for (int pos = 0; pos < StrategyControl->heapSize && best < 0; pos++)
+		{
+			if (BUF_STATE_GET_REFCOUNT(pg_atomic_read_u32(&GetBufferDescriptor(lrukHeap[pos])->state)) == 0)
+				best = lrukHeap[pos];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * LrukGetVictim -- return the best unpinned buffer, with its header spinlock
+ *		held, or NULL if every buffer is pinned.
+ *
+ * Usually that is the root of the heap.  If the root is pinned, the heap is
+ * searched best-first: a position only becomes a candidate once its parent
+ * turned out to be pinned, so only the pinned buffers near the top of the
+ * heap and their children are ever looked at.
+ *
+ * Caller must hold lruk_lock.
+ */
+static BufferDesc *
+LrukGetVictim(uint32 *buf_state)
+{
+	int			candidates[LRUK_MAX_CANDIDATES];
+	int			ncandidates = 0;
+	int			examined = 0;
+
+	if (StrategyControl->heapSize > 0)
+		candidates[ncandidates++] = 0;
+
+	while (ncandidates > 0)
+	{
+		int			best = 0;
+		int			pos;
+		BufferDesc *buf;
+		uint32		local_buf_state;
+
+		for (int i = 1; i < ncandidates; i++)
+		{
+			if (LrukBetterVictim(lrukHeap[candidates[i]], lrukHeap[candidates[best]]))
+				best = i;
+		}
+		pos = candidates[best];
+		candidates[best] = candidates[--ncandidates];
+
+		buf = GetBufferDescriptor(lrukHeap[pos]);
+		local_buf_state = LockBufHdr(buf);
+
+		/* usage_count is ignored by LRU-K, only pins matter */
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		{
+			*buf_state = local_buf_state;
+			return buf;
+		}
+		UnlockBufHdr(buf, local_buf_state);
+
+		if (++examined >= LRUK_MAX_CANDIDATES - 1)
+			return LrukScanVictim(buf_state);
+
+		for (int child = 2 * pos + 1; child <= 2 * pos + 2; child++)
+		{
+			if (child < StrategyControl->heapSize)
+				candidates[ncandidates++] = child;
+		}
+	}
+
+	return NULL;
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The tag is used to find the retained references of the page.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	lrukHaveIncomingTag = (tag != NULL);
+	if (tag != NULL)
+		lrukIncomingTag = *tag;
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Records a reference to buffer (identified by buf_id) and adjusts its position in the heap if delete is false;
+// otherwise, delete buffer buf_id from the heap.  A dropped page leaves no history behind.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	SpinLockAcquire(&StrategyControl->lruk_lock);
+
+	if (delete)
+		LrukHeapRemove(buf_id);
+	else
+		LrukReferenceBuffer(buf_id);
+
+	SpinLockRelease(&StrategyControl->lruk_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  lruk_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be reloaded while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->lruk_lock);
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			LrukLoadBuffer(buf, *buf_state);
+			SpinLockRelease(&StrategyControl->lruk_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->lruk_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For lru-k implementation, usage_count is not important or ignored.
+			 */
+			SpinLockAcquire(&StrategyControl->lruk_lock);
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				LrukLoadBuffer(buf, local_buf_state);
+				SpinLockRelease(&StrategyControl->lruk_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->lruk_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run LRU-K: take the unpinned buffer with
+	 * the largest backward K-distance, found at or near the top of the heap.
+	 */
+	SpinLockAcquire(&StrategyControl->lruk_lock);
+
+	buf = LrukGetVictim(buf_state);
+	if (buf == NULL)
+	{
+		SpinLockRelease(&StrategyControl->lruk_lock);
+		elog(ERROR, "no unpinned buffers available");
+	}
+
+	if (strategy != NULL)
+		AddBufferToRing(strategy, buf);
+	LrukLoadBuffer(buf, *buf_state);
+
+	SpinLockRelease(&StrategyControl->lruk_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the heap
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * LrukReadK -- look up the lruk.k setting.
+ *
+ * The setting cannot be defined as a custom PGC_POSTMASTER variable: the
+ * server only allows that while shared_preload_libraries are being loaded,
+ * and we run from the creation of shared memory.  So it stays a placeholder
+ * and its value is read here, in the postmaster, when shared memory is sized.
+ */
+static int
+LrukReadK(void)
+{
+	const char *value;
+	int			k;
+
+	value = GetConfigOption("lruk.k", true, false);
+	if (value == NULL)
+		return LRUK_DEFAULT_K;
+
+	if (!parse_int(value, &k, 0, NULL) || k < 1 || k > LRUK_MAX_K)
+		ereport(FATAL,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for parameter \"%s\": \"%s\"",
+						"lruk.k", value),
+				 errhint("Valid values are integers from 1 to %d.", LRUK_MAX_K)));
+	return k;
+}
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* the arrays below are sized from K */
+	lrukK = LrukReadK();
+
+	/* size of the per-buffer references and of the heap */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LrukBufferInfo), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(mul_size(sizeof(uint64), lrukK), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int), NBuffers)));
+
+	/* size of the history table of evicted pages */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(LrukHistoryEntry),
+											mul_size(LRUK_HISTORY_SETS, LRUK_HISTORY_WAYS))));
+	size = add_size(size, MAXALIGN(mul_size(mul_size(sizeof(uint64), lrukK),
+											mul_size(LRUK_HISTORY_SETS, LRUK_HISTORY_WAYS))));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		lruk_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->lruk_lock);
+		StrategyControl->accessClock = 0;
+		StrategyControl->heapSize = 0;
+		StrategyControl->k = lrukK;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+	{
+		Assert(!init);
+
+		/* StrategyShmemSize only ran in the postmaster */
+		lrukK = StrategyControl->k;
+	}
+
+	/* Get or create the per-buffer references, the heap and the history */
+	lrukInfo = (LrukBufferInfo *)
+		ShmemInitStruct("LRU-K buffer info",
+						MAXALIGN(mul_size(sizeof(LrukBufferInfo), NBuffers)),
+						&lruk_found);
+	lrukRefs = (uint64 *)
+		ShmemInitStruct("LRU-K buffer references",
+						MAXALIGN(mul_size(mul_size(sizeof(uint64), lrukK), NBuffers)),
+						&lruk_found);
+	lrukHeap = (int *)
+		ShmemInitStruct("LRU-K heap",
+						MAXALIGN(mul_size(sizeof(int), NBuffers)),
+						&lruk_found);
+	lrukHistory = (LrukHistoryEntry *)
+		ShmemInitStruct("LRU-K history",
+						MAXALIGN(mul_size(sizeof(LrukHistoryEntry),
+										  mul_size(LRUK_HISTORY_SETS, LRUK_HISTORY_WAYS))),
+						&lruk_found);
+	lrukHistoryRefs = (uint64 *)
+		ShmemInitStruct("LRU-K history references",
+						MAXALIGN(mul_size(mul_size(sizeof(uint64), lrukK),
+										  mul_size(LRUK_HISTORY_SETS, LRUK_HISTORY_WAYS))),
+						&lruk_found);
+
+	if (!lruk_found)
+	{
+		Assert(init);
+
+		// the heap starts out empty, buffers enter it when first loaded
+		memset(lrukRefs, 0, mul_size(mul_size(sizeof(uint64), lrukK), NBuffers));
+		for (int i = 0; i < NBuffers; i++)
+			lrukInfo[i].heapPos = -1;
+
+		for (int i = 0; i < LRUK_HISTORY_SETS * LRUK_HISTORY_WAYS; i++)
+			lrukHistory[i].valid = false;
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
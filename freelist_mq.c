@@ -0,0 +1,1211 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "port/pg_bitutils.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * MQ (Multi-Queue, Zhou, Philbin and Li) was designed for second-level
+ * buffer caches, such as shared buffers above the kernel page cache, whose
+ * access stream has weak recency because the first-level cache absorbs the
+ * re-references.  It keeps every buffer in use on one of MQ_NUM_QUEUES LRU
+ * queues, most recently used at the top:
+ *
+ *	Q0 .. Qm-1 - Qk holds the buffers whose page has been referenced
+ *				 2^k .. 2^(k+1) - 1 times, Qm-1 all the more frequent ones.
+ *	Qout	   - tags and reference counts of recently evicted pages, so
+ *				 that a page read in again continues with its count.
+ *
+ * The victim is the least recently used unpinned buffer of the lowest
+ * non-empty queue.  Every buffer also has an expiry time, MQ_LIFE_TIME
+ * references after its last one; when the least recently used buffer of a
+ * queue Qk, k > 0, has expired, it is demoted to Qk-1, so pages that were
+ * frequently referenced long ago drift down and out.  Time is counted in
+ * references.
+ *
+ * Nodes are linked by int32 index into mqNodes[], like the LRU stack in
+ * freelist_lru.c: entries 0 .. NBuffers - 1 belong to the buffers, then
+ * come the MQ_QOUT_ENTRIES Qout entries, followed by the head and tail
+ * sentinels of the queues and of Qout.
+ */
+#define MQ_NUM_QUEUES	8
+#define MQ_QOUT_ENTRIES	(4 * NBuffers)
+#define MQ_LIFE_TIME	((uint64) 2 * NBuffers)
+
+typedef struct MqNode
+{
+	int32		prev;
+	int32		next;
+	int			list;			/* MQ_LIST_xxx, or MqQueueList(k) */
+} MqNode;
+
+#define MQ_NODE_NOT_IN_LIST	(-1)
+
+#define MQ_LIST_NONE	0
+#define MQ_LIST_QOUT	(MQ_NUM_QUEUES + 1)
+#define MQ_NUM_LISTS	(MQ_NUM_QUEUES + 1)
+
+#define MqQueueList(k)	((k) + 1)
+#define MqListQueue(list)	((list) - 1)
+
+/* sentinel entries of a list: top is head.next, bottom tail.prev */
+#define MqListHead(list)	(NBuffers + MQ_QOUT_ENTRIES + 2 * ((list) - 1))
+#define MqListTail(list)	(NBuffers + MQ_QOUT_ENTRIES + 2 * ((list) - 1) + 1)
+
+#define MqGhostNode(ghost)	(NBuffers + (ghost))
+#define MqNodeGhost(node)	((node) - NBuffers)
+
+#define MQ_NODES		(NBuffers + MQ_QOUT_ENTRIES + 2 * MQ_NUM_LISTS)
+
+/* Reference count and expiry time of the page in a buffer */
+typedef struct MqBufferInfo
+{
+	uint32		frequency;
+	uint64		expireTime;
+} MqBufferInfo;
+
+/*
+ * A Qout entry holds the tag and reference count of an evicted page.  Qout
+ * entries are found by tag through a chained hash table, mqGhostBuckets[];
+ * hashNext also links the unused entries together.
+ */
+typedef struct MqGhost
+{
+	BufferTag	tag;
+	uint32		frequency;
+	int32		hashNext;
+} MqGhost;
+
+#define MQ_GHOST_NONE	(-1)
+
+static MqNode *mqNodes = NULL;
+static MqBufferInfo *mqInfo = NULL;
+static MqGhost *mqGhosts = NULL;
+static int32 *mqGhostBuckets = NULL;
+
+/*
+ * Tag of the page bufmgr is about to read in, see StrategySetIncomingTag.
+ * Backend-private.
+ */
+static BufferTag mqIncomingTag;
+static bool mqHaveIncomingTag = false;
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects the MQ queues, mqInfo[], the Qout entries and the
+	 * fields below.  When a buffer header spinlock is needed as well,
+	 * mq_lock is always taken first.
+	 */
+	slock_t		mq_lock;
+
+	uint64		currentTime;	/* advanced on every reference */
+	int			listLength[MQ_NUM_LISTS + 1];	/* indexed by list */
+	int32		firstFreeGhost; /* head of list of unused Qout entries */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+/*
+ * MqListRemove -- unlink node from the list it is on, if any.
+ *
+ * Caller must hold mq_lock.
+ */
+static inline void
+MqListRemove(int32 node)
+{
+	MqNode	   *curr = &mqNodes[node];
+
+	if (curr->list == MQ_LIST_NONE)
+		return;
+
+	mqNodes[curr->prev].next = curr->next;
+	mqNodes[curr->next].prev = curr->prev;
+	StrategyControl->listLength[curr->list]--;
+
+	curr->prev = MQ_NODE_NOT_IN_LIST;
+	curr->next = MQ_NODE_NOT_IN_LIST;
+	curr->list = MQ_LIST_NONE;
+}
+
+/*
+ * MqListPushTop -- link node in at the top of list.
+ *
+ * Caller must hold mq_lock, and the node must not be on any list.
+ */
+static inline void
+MqListPushTop(int list, int32 node)
+{
+	MqNode	   *curr = &mqNodes[node];
+	int32		head = MqListHead(list);
+
+	curr->prev = head;
+	curr->next = mqNodes[head].next;
+	mqNodes[curr->next].prev = node;
+	mqNodes[head].next = node;
+	curr->list = list;
+	StrategyControl->listLength[list]++;
+}
+
+static inline int32 *
+MqGhostBucket(BufferTag *tag)
+{
+	return &mqGhostBuckets[BufTableHashCode(tag) % MQ_QOUT_ENTRIES];
+}
+
+/*
+ * MqGhostLookup -- return the Qout entry remembering tag, or
+ *		MQ_GHOST_NONE.
+ *
+ * Caller must hold mq_lock.
+ */
+static int32
+MqGhostLookup(BufferTag *tag)
+{
+	int32		ghost;
+
+	for (ghost = *MqGhostBucket(tag);
+		 ghost != MQ_GHOST_NONE;
+		 ghost = mqGhosts[ghost].hashNext)
+	{
+		if (BufferTagsEqual(&mqGhosts[ghost].tag, tag))
+			return ghost;
+	}
+
+	return MQ_GHOST_NONE;
+}
+
+/*
+ * MqGhostForget -- take a Qout entry off Qout and out of the hash table,
+ *		and make it available for reuse.
+ *
+ * Caller must hold mq_lock.
+ */
+static void
+MqGhostForget(int32 ghost)
+{
+	int32	   *link = MqGhostBucket(&mqGhosts[ghost].tag);
+
+	while (*link != ghost)
+		link = &mqGhosts[*link].hashNext;
+	*link = mqGhosts[ghost].hashNext;
+
+	MqListRemove(MqGhostNode(ghost));
+
+	mqGhosts[ghost].hashNext = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = ghost;
+}
+
+/*
+ * MqGhostRemember -- put tag and its reference count at the top of Qout,
+ *		forgetting the oldest entry if Qout is full.
+ *
+ * Caller must hold mq_lock.
+ */
+static void
+MqGhostRemember(BufferTag *tag, uint32 frequency)
+{
+	int32		ghost;
+	int32	   *bucket;
+
+	if (StrategyControl->firstFreeGhost == MQ_GHOST_NONE)
+		MqGhostForget(MqNodeGhost(mqNodes[MqListTail(MQ_LIST_QOUT)].prev));
+
+	ghost = StrategyControl->firstFreeGhost;
+	StrategyControl->firstFreeGhost = mqGhosts[ghost].hashNext;
+
+	bucket = MqGhostBucket(tag);
+	mqGhosts[ghost].tag = *tag;
+	mqGhosts[ghost].frequency = frequency;
+	mqGhosts[ghost].hashNext = *bucket;
+	*bucket = ghost;
+
+	MqListPushTop(MQ_LIST_QOUT, MqGhostNode(ghost));
+}
+
+/*
+ * MqQueueFor -- the queue for a page referenced frequency times.
+ */
+static inline int
+MqQueueFor(uint32 frequency)
+{
+	return Min(pg_leftmost_one_pos32(frequency), MQ_NUM_QUEUES - 1);
+}
+
+/*
+ * MqAdjust -- demote the least recently used buffer of every queue above
+ *		Q0 to the next lower queue if it has expired.
+ *
+ * Caller must hold mq_lock.
+ */
+static void
+MqAdjust(void)
+{
+	uint64		now = StrategyControl->currentTime;
+
+	for (int k = 1; k < MQ_NUM_QUEUES; k++)
+	{
+		int32		bottom = mqNodes[MqListTail(MqQueueList(k))].prev;
+
+		if (bottom == MqListHead(MqQueueList(k)) ||
+			mqInfo[bottom].expireTime >= now)
+			continue;
+
+		MqListRemove(bottom);
+		MqListPushTop(MqQueueList(k - 1), bottom);
+		mqInfo[bottom].expireTime = now + MQ_LIFE_TIME;
+	}
+}
+
+/*
+ * MqReferenceBuffer -- count a reference to the page in buffer, and move the
+ *		buffer to the top of the queue for its new reference count.
+ *
+ * Caller must hold mq_lock.
+ */
+static void
+MqReferenceBuffer(int buf_id, uint32 frequency)
+{
+	MqBufferInfo *info = &mqInfo[buf_id];
+	uint64		now = ++StrategyControl->currentTime;
+
+	info->frequency = frequency;
+	info->expireTime = now + MQ_LIFE_TIME;
+
+	MqListRemove(buf_id);
+	MqListPushTop(MqQueueList(MqQueueFor(frequency)), buf_id);
+
+	MqAdjust();
+}
+
+/*
+ * MqLoadBuffer -- note that buffer is about to be (re)loaded with the
+ *		incoming page.
+ *
+ * The page previously held in the buffer, if any, is remembered on Qout
+ * with its reference count.  The incoming page continues with the count
+ * remembered for it on Qout, if any.  The caller holds the buffer header
+ * spinlock, so buf->tag and buf_state still describe the previous page.
+ *
+ * Caller must hold mq_lock.
+ */
+static void
+MqLoadBuffer(BufferDesc *buf, uint32 buf_state)
+{
+	uint32		frequency = 1;
+
+	// look up first, so that remembering the previous page cannot push the
+	// incoming one off Qout
+	if (mqHaveIncomingTag)
+	{
+		int32		ghost = MqGhostLookup(&mqIncomingTag);
+
+		if (ghost != MQ_GHOST_NONE)
+		{
+			frequency = mqGhosts[ghost].frequency + 1;
+			MqGhostForget(ghost);
+		}
+	}
+
+	if (mqNodes[buf->buf_id].list != MQ_LIST_NONE && (buf_state & BM_TAG_VALID))
+		MqGhostRemember(&buf->tag, mqInfo[buf->buf_id].frequency);
+
+	MqReferenceBuffer(buf->buf_id, frequency);
+}
+
+/*
+ * MqGetVictim -- return the least recently used unpinned buffer of the
+ *		lowest queue that has one, with its header spinlock held, or NULL if
+ *		every buffer is pinned.
+ *
+ * Caller must hold mq_lock.
+ */
+static BufferDesc *
+MqGetVictim(uint32 *buf_state)
+{
+	for (int k = 0; k < MQ_NUM_QUEUES; k++)
+	{
+		int32		victim;
+
+		for (victim = mqNodes[MqListTail(MqQueueList(k))].prev;
+			 victim != MqListHead(MqQueueList(k));
+			 victim = mqNodes[victim].prev)
+		{
+			BufferDesc *buf = GetBufferDescriptor(victim);
+			uint32		local_buf_state = LockBufHdr(buf);
+
+			/* usage_count is ignored by MQ, only pins matter */
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+		}
+	}
+
+	return NULL;
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The tag is looked up in Qout.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	mqHaveIncomingTag = (tag != NULL);
+	if (tag != NULL)
+		mqIncomingTag = *tag;
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Counts a reference to buffer (identified by buf_id) and moves it to the top of the queue for its
+// reference count if delete is false; otherwise, delete buffer buf_id from the MQ queues.
+// A dropped page is not remembered on Qout.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	SpinLockAcquire(&StrategyControl->mq_lock);
+
+	if (delete)
+		MqListRemove(buf_id);
+	else
+		MqReferenceBuffer(buf_id, mqInfo[buf_id].frequency + 1);
+
+	SpinLockRelease(&StrategyControl->mq_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  mq_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be reloaded while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->mq_lock);
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			MqLoadBuffer(buf, *buf_state);
+			SpinLockRelease(&StrategyControl->mq_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->mq_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For mq implementation, usage_count is not important or ignored.
+			 */
+			SpinLockAcquire(&StrategyControl->mq_lock);
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				MqLoadBuffer(buf, local_buf_state);
+				SpinLockRelease(&StrategyControl->mq_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->mq_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run MQ: evict from the lowest queue that
+	 * has an unpinned buffer.
+	 */
+	SpinLockAcquire(&StrategyControl->mq_lock);
+
+	buf = MqGetVictim(buf_state);
+	if (buf == NULL)
+	{
+		SpinLockRelease(&StrategyControl->mq_lock);
+		elog(ERROR, "no unpinned buffers available");
+	}
+
+	if (strategy != NULL)
+		AddBufferToRing(strategy, buf);
+	MqLoadBuffer(buf, *buf_state);
+
+	SpinLockRelease(&StrategyControl->mq_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves the MQ queues
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* size of the MQ list nodes, including Qout entries and sentinels */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(MqNode), MQ_NODES)));
+
+	/* size of the per-buffer reference counts and expiry times */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(MqBufferInfo), NBuffers)));
+
+	/* size of the Qout entries and their hash buckets */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(MqGhost), MQ_QOUT_ENTRIES)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(int32), MQ_QOUT_ENTRIES)));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		mq_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->mq_lock);
+		StrategyControl->currentTime = 0;
+		for (int list = MQ_LIST_NONE; list <= MQ_NUM_LISTS; list++)
+			StrategyControl->listLength[list] = 0;
+		StrategyControl->firstFreeGhost = 0;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+		Assert(!init);
+
+	/* Get or create the MQ queues and Qout entries, all lists start empty */
+	mqNodes = (MqNode *)
+		ShmemInitStruct("MQ list nodes",
+						MAXALIGN(mul_size(sizeof(MqNode), MQ_NODES)),
+						&mq_found);
+	mqInfo = (MqBufferInfo *)
+		ShmemInitStruct("MQ buffer reference counts",
+						MAXALIGN(mul_size(sizeof(MqBufferInfo), NBuffers)),
+						&mq_found);
+	mqGhosts = (MqGhost *)
+		ShmemInitStruct("MQ Qout entries",
+						MAXALIGN(mul_size(sizeof(MqGhost), MQ_QOUT_ENTRIES)),
+						&mq_found);
+	mqGhostBuckets = (int32 *)
+		ShmemInitStruct("MQ Qout hash buckets",
+						MAXALIGN(mul_size(sizeof(int32), MQ_QOUT_ENTRIES)),
+						&mq_found);
+
+	if (!mq_found)
+	{
+		Assert(init);
+
+		for (int i = 0; i < NBuffers + MQ_QOUT_ENTRIES; i++)
+		{
+			mqNodes[i].prev = MQ_NODE_NOT_IN_LIST;
+			mqNodes[i].next = MQ_NODE_NOT_IN_LIST;
+			mqNodes[i].list = MQ_LIST_NONE;
+		}
+
+		for (int list = MqQueueList(0); list <= MQ_NUM_LISTS; list++)
+		{
+			mqNodes[MqListHead(list)].prev = MQ_NODE_NOT_IN_LIST;
+			mqNodes[MqListHead(list)].next = MqListTail(list);
+			mqNodes[MqListHead(list)].list = list;
+			mqNodes[MqListTail(list)].prev = MqListHead(list);
+			mqNodes[MqListTail(list)].next = MQ_NODE_NOT_IN_LIST;
+			mqNodes[MqListTail(list)].list = list;
+		}
+
+		for (int i = 0; i < NBuffers; i++)
+		{
+			mqInfo[i].frequency = 0;
+			mqInfo[i].expireTime = 0;
+		}
+
+		// every Qout entry starts out unused
+		for (int i = 0; i < MQ_QOUT_ENTRIES; i++)
+		{
+			mqGhosts[i].hashNext = (i + 1 < MQ_QOUT_ENTRIES) ? i + 1 : MQ_GHOST_NONE;
+			mqGhostBuckets[i] = MQ_GHOST_NONE;
+		}
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
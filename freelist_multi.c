@@ -0,0 +1,431 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "pgstat.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+
+#include "freelist_policy.h"
+
+/*
+ * The replacement policy is chosen with the bufmgr.replacement_policy
+ * setting, so that policies can be compared with a restart rather than by
+ * copying a different freelist.c into the source tree and rebuilding.
+ *
+ * There is no policy code in this file.  "make multi" links every
+ * freelist_<policy>.c into the server next to it, each compiled unchanged
+ * but with its entry points renamed (see freelist_policy.h), and every entry
+ * point here passes the call on to the chosen policy's entry in
+ * bufferStrategyPolicies[].  So each policy behaves exactly as it does when
+ * built on its own, and a fix to a policy needs to be made only once.  Only
+ * the chosen policy's shared state is allocated, since only its
+ * StrategyShmemSize and StrategyInitialize are called; optional hooks of
+ * bufmgr_lru.c, such as StrategyUnpinBuffer_hook, are set by the chosen
+ * policy's StrategyInitialize itself.
+ *
+ * "clock" is the stock policy of freelist.original.c.
+ */
+typedef enum BufferReplacementPolicy
+{
+	BUFFER_POLICY_CLOCK,
+	BUFFER_POLICY_LRU,
+	BUFFER_POLICY_ELRU,
+	BUFFER_POLICY_LRUK,
+	BUFFER_POLICY_ARC,
+	BUFFER_POLICY_CAR,
+	BUFFER_POLICY_2Q,
+	BUFFER_POLICY_LIRS,
+	BUFFER_POLICY_CLOCKPRO,
+	BUFFER_POLICY_SIEVE,
+	BUFFER_POLICY_S3FIFO,
+	BUFFER_POLICY_TINYLFU,
+	BUFFER_POLICY_SLRU,
+	BUFFER_POLICY_LFUDA,
+	BUFFER_POLICY_GREEDYDUAL,
+	BUFFER_POLICY_LRFU,
+	BUFFER_POLICY_MQ,
+	BUFFER_POLICY_LECAR
+} BufferReplacementPolicy;
+
+static const struct config_enum_entry replacement_policy_options[] = {
+	{"clock", BUFFER_POLICY_CLOCK, false},
+	{"lru", BUFFER_POLICY_LRU, false},
+	{"elru", BUFFER_POLICY_ELRU, false},
+	{"lruk", BUFFER_POLICY_LRUK, false},
+	{"arc", BUFFER_POLICY_ARC, false},
+	{"car", BUFFER_POLICY_CAR, false},
+	{"2q", BUFFER_POLICY_2Q, false},
+	{"lirs", BUFFER_POLICY_LIRS, false},
+	{"clockpro", BUFFER_POLICY_CLOCKPRO, false},
+	{"sieve", BUFFER_POLICY_SIEVE, false},
+	{"s3fifo", BUFFER_POLICY_S3FIFO, false},
+	{"tinylfu", BUFFER_POLICY_TINYLFU, false},
+	{"slru", BUFFER_POLICY_SLRU, false},
+	{"lfuda", BUFFER_POLICY_LFUDA, false},
+	{"greedydual", BUFFER_POLICY_GREEDYDUAL, false},
+	{"lrfu", BUFFER_POLICY_LRFU, false},
+	{"mq", BUFFER_POLICY_MQ, false},
+	{"lecar", BUFFER_POLICY_LECAR, false},
+	{NULL, 0, false}
+};
+
+/* Policy named by the setting, read by StrategyShmemSize */
+static int	buffer_replacement_policy = BUFFER_POLICY_CLOCK;
+
+FREELIST_POLICY_DECLARE(clock);
+FREELIST_POLICY_DECLARE(lru);
+FREELIST_POLICY_DECLARE(elru);
+FREELIST_POLICY_DECLARE(lruk);
+FREELIST_POLICY_DECLARE(arc);
+FREELIST_POLICY_DECLARE(car);
+FREELIST_POLICY_DECLARE(2q);
+FREELIST_POLICY_DECLARE(lirs);
+FREELIST_POLICY_DECLARE(clockpro);
+FREELIST_POLICY_DECLARE(sieve);
+FREELIST_POLICY_DECLARE(s3fifo);
+FREELIST_POLICY_DECLARE(tinylfu);
+FREELIST_POLICY_DECLARE(slru);
+FREELIST_POLICY_DECLARE(lfuda);
+FREELIST_POLICY_DECLARE(greedydual);
+FREELIST_POLICY_DECLARE(lrfu);
+FREELIST_POLICY_DECLARE(mq);
+FREELIST_POLICY_DECLARE(lecar);
+
+/*
+ * Entry points of a replacement policy, the public functions of its
+ * freelist_<policy>.c.
+ */
+typedef struct BufferStrategyPolicy
+{
+	const char *name;
+
+	BufferDesc *(*get_buffer) (BufferAccessStrategy strategy,
+							   uint32 *buf_state, bool *from_ring);
+	void		(*free_buffer) (BufferDesc *buf);
+	int			(*sync_start) (uint32 *complete_passes, uint32 *num_buf_alloc);
+	void		(*notify_bgwriter) (int bgwprocno);
+	Size		(*shmem_size) (void);
+	void		(*initialize) (bool init);
+	bool		(*have_free_buffer) (void);
+	BufferAccessStrategy (*get_access_strategy) (BufferAccessStrategyType btype);
+	BufferAccessStrategy (*get_access_strategy_with_size) (BufferAccessStrategyType btype,
+														   int ring_size_kb);
+	int			(*get_access_strategy_buffer_count) (BufferAccessStrategy strategy);
+	void		(*free_access_strategy) (BufferAccessStrategy strategy);
+	IOContext	(*io_context_for_strategy) (BufferAccessStrategy strategy);
+	bool		(*reject_buffer) (BufferAccessStrategy strategy, BufferDesc *buf,
+								  bool from_ring);
+
+	/*
+	 * cs3223 hooks of bufmgr_lru.c; NULL for a policy built for another
+	 * bufmgr.c that does not call the hook.
+	 */
+	void		(*access_buffer) (int buf_id, bool delete);
+	void		(*set_incoming_tag) (const BufferTag *tag);
+} BufferStrategyPolicy;
+
+/* the entry points every policy has, in BufferStrategyPolicy order */
+#define BUFFER_STRATEGY_POLICY_ENTRY_POINTS(policy) \
+	FREELIST_POLICY_NAME(StrategyGetBuffer, policy), \
+	FREELIST_POLICY_NAME(StrategyFreeBuffer, policy), \
+	FREELIST_POLICY_NAME(StrategySyncStart, policy), \
+	FREELIST_POLICY_NAME(StrategyNotifyBgWriter, policy), \
+	FREELIST_POLICY_NAME(StrategyShmemSize, policy), \
+	FREELIST_POLICY_NAME(StrategyInitialize, policy), \
+	FREELIST_POLICY_NAME(have_free_buffer, policy), \
+	FREELIST_POLICY_NAME(GetAccessStrategy, policy), \
+	FREELIST_POLICY_NAME(GetAccessStrategyWithSize, policy), \
+	FREELIST_POLICY_NAME(GetAccessStrategyBufferCount, policy), \
+	FREELIST_POLICY_NAME(FreeAccessStrategy, policy), \
+	FREELIST_POLICY_NAME(IOContextForStrategy, policy), \
+	FREELIST_POLICY_NAME(StrategyRejectBuffer, policy)
+
+/* the cs3223 hooks of a policy built for bufmgr_lru.c */
+#define BUFFER_STRATEGY_POLICY_HOOKS(policy) \
+	FREELIST_POLICY_NAME(StrategyAccessBuffer, policy), \
+	FREELIST_POLICY_NAME(StrategySetIncomingTag, policy)
+
+#define BUFFER_STRATEGY_POLICY(policy) \
+	{ \
+		#policy, \
+		BUFFER_STRATEGY_POLICY_ENTRY_POINTS(policy), \
+		BUFFER_STRATEGY_POLICY_HOOKS(policy) \
+	}
+
+/* indexed by BufferReplacementPolicy */
+static const BufferStrategyPolicy bufferStrategyPolicies[] = {
+	/* freelist.original.c, built for bufmgr.original.c */
+	{
+		"clock",
+		BUFFER_STRATEGY_POLICY_ENTRY_POINTS(clock),
+		NULL, NULL
+	},
+	BUFFER_STRATEGY_POLICY(lru),
+	/* built for bufmgr_elru.c, which only calls StrategyAccessBuffer */
+	{
+		"elru",
+		BUFFER_STRATEGY_POLICY_ENTRY_POINTS(elru),
+		FREELIST_POLICY_NAME(StrategyAccessBuffer, elru), NULL
+	},
+	BUFFER_STRATEGY_POLICY(lruk),
+	BUFFER_STRATEGY_POLICY(arc),
+	BUFFER_STRATEGY_POLICY(car),
+	BUFFER_STRATEGY_POLICY(2q),
+	BUFFER_STRATEGY_POLICY(lirs),
+	BUFFER_STRATEGY_POLICY(clockpro),
+	BUFFER_STRATEGY_POLICY(sieve),
+	BUFFER_STRATEGY_POLICY(s3fifo),
+	BUFFER_STRATEGY_POLICY(tinylfu),
+	BUFFER_STRATEGY_POLICY(slru),
+	BUFFER_STRATEGY_POLICY(lfuda),
+	BUFFER_STRATEGY_POLICY(greedydual),
+	BUFFER_STRATEGY_POLICY(lrfu),
+	BUFFER_STRATEGY_POLICY(mq),
+	BUFFER_STRATEGY_POLICY(lecar)
+};
+
+StaticAssertDecl(lengthof(bufferStrategyPolicies) == lengthof(replacement_policy_options) - 1,
+				 "bufferStrategyPolicies[] must have an entry for every policy");
+
+/*
+ * Replacement policy the shared state was set up for, so that every process
+ * dispatches to the same policy even if it was started with another setting
+ * (EXEC_BACKEND).
+ */
+static int *sharedReplacementPolicy = NULL;
+
+/* Policy in use, resolved by StrategyInitialize */
+static const BufferStrategyPolicy *strategyPolicy = NULL;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+extern bool bgwriter_lru_scan; /* cs3223 */
+
+/*
+ * ReadReplacementPolicySetting -- look up bufmgr.replacement_policy.
+ *
+ * The setting cannot be defined as a custom PGC_POSTMASTER variable: the
+ * server only allows that while shared_preload_libraries are being loaded,
+ * and we run from the creation of shared memory.  So it stays the
+ * placeholder the server makes for any setting with a prefix, and its
+ * value is read here, in the postmaster, each time shared memory is sized.
+ * Like a PGC_POSTMASTER variable, a change only takes effect at restart.
+ */
+static int
+ReadReplacementPolicySetting(void)
+{
+	const char *value;
+	StringInfoData names;
+
+	value = GetConfigOption("bufmgr.replacement_policy", true, false);
+	if (value == NULL)
+		return BUFFER_POLICY_CLOCK;
+
+	for (const struct config_enum_entry *entry = replacement_policy_options;
+		 entry->name != NULL; entry++)
+	{
+		if (pg_strcasecmp(value, entry->name) == 0)
+			return entry->val;
+	}
+
+	initStringInfo(&names);
+	for (const struct config_enum_entry *entry = replacement_policy_options;
+		 entry->name != NULL; entry++)
+		appendStringInfo(&names, "%s%s", names.len > 0 ? ", " : "", entry->name);
+
+	ereport(FATAL,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid value for parameter \"%s\": \"%s\"",
+					"bufmgr.replacement_policy", value),
+			 errhint("Available values: %s.", names.data)));
+	return BUFFER_POLICY_CLOCK;	/* keep compiler quiet */
+}
+
+// cs3223
+// StrategyAccessBuffer
+// Called by bufmgr when a buffer page is accessed.
+// Passed on to the replacement policy in use.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (strategyPolicy->access_buffer != NULL)
+		strategyPolicy->access_buffer(buf_id, delete);
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// Passed on to the replacement policy in use.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	if (strategyPolicy->set_incoming_tag != NULL)
+		strategyPolicy->set_incoming_tag(tag);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(); see the policy's own StrategyGetBuffer.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	return strategyPolicy->get_buffer(strategy, buf_state, from_ring);
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	strategyPolicy->free_buffer(buf);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	return strategyPolicy->sync_start(complete_passes, num_buf_alloc);
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	strategyPolicy->notify_bgwriter(bgwprocno);
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ */
+bool
+have_free_buffer(void)
+{
+	return strategyPolicy->have_free_buffer();
+}
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures,
+ * which are the chosen policy's.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	buffer_replacement_policy = ReadReplacementPolicySetting();
+
+	size = add_size(size, MAXALIGN(sizeof(int)));
+	size = add_size(size, bufferStrategyPolicies[buffer_replacement_policy].shmem_size());
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Records the policy StrategyShmemSize has sized shared memory for, or
+ * looks it up when attaching, then lets it set up, or attach to, its own
+ * shared state.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+
+	sharedReplacementPolicy = (int *)
+		ShmemInitStruct("Buffer Replacement Policy", sizeof(int), &found);
+
+	if (!found)
+	{
+		Assert(init);
+		*sharedReplacementPolicy = buffer_replacement_policy;
+	}
+	else
+		Assert(!init);
+
+	strategyPolicy = &bufferStrategyPolicies[*sharedReplacementPolicy];
+
+	/*
+	 * The stock bufmgr.c that "clock" is built for runs the background
+	 * writer's LRU scan, which bufmgr_lru.c leaves off for every other
+	 * policy; see bgwriter_lru_scan.
+	 */
+	if (*sharedReplacementPolicy == BUFFER_POLICY_CLOCK)
+		bgwriter_lru_scan = true;
+	strategyPolicy->initialize(init);
+}
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ *
+ * A BufferAccessStrategy is only ever handed back to the policy that
+ * created it, so each policy keeps its own ring code.
+ * ----------------------------------------------------------------
+ */
+
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	return strategyPolicy->get_access_strategy(btype);
+}
+
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	return strategyPolicy->get_access_strategy_with_size(btype, ring_size_kb);
+}
+
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	return strategyPolicy->get_access_strategy_buffer_count(strategy);
+}
+
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	strategyPolicy->free_access_strategy(strategy);
+}
+
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	return strategyPolicy->io_context_for_strategy(strategy);
+}
+
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	return strategyPolicy->reject_buffer(strategy, buf, from_ring);
+}
@@ -0,0 +1,72 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist_policy.h
+ *	  renaming of the entry points of a replacement policy, so that every
+ *	  freelist_<policy>.c can be linked into one server behind
+ *	  freelist_multi.c.
+ *
+ * The multi build compiles each freelist_<policy>.c unchanged, with this
+ * header force-included and FREELIST_POLICY set to the policy's name (see
+ * Makefile.buffer.multi), which turns StrategyGetBuffer into
+ * StrategyGetBuffer_<policy> and so on.  freelist_multi.c includes it
+ * without FREELIST_POLICY, to declare the renamed entry points with
+ * FREELIST_POLICY_DECLARE and dispatch to the chosen policy's.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef FREELIST_POLICY_H
+#define FREELIST_POLICY_H
+
+#define FREELIST_POLICY_NAME(name, policy)	FREELIST_POLICY_NAME_(name, policy)
+#define FREELIST_POLICY_NAME_(name, policy)	name##_##policy
+
+#ifdef FREELIST_POLICY
+
+#define StrategyGetBuffer				FREELIST_POLICY_NAME(StrategyGetBuffer, FREELIST_POLICY)
+#define StrategyFreeBuffer				FREELIST_POLICY_NAME(StrategyFreeBuffer, FREELIST_POLICY)
+#define StrategySyncStart				FREELIST_POLICY_NAME(StrategySyncStart, FREELIST_POLICY)
+#define StrategyNotifyBgWriter			FREELIST_POLICY_NAME(StrategyNotifyBgWriter, FREELIST_POLICY)
+#define StrategyShmemSize				FREELIST_POLICY_NAME(StrategyShmemSize, FREELIST_POLICY)
+#define StrategyInitialize				FREELIST_POLICY_NAME(StrategyInitialize, FREELIST_POLICY)
+#define have_free_buffer				FREELIST_POLICY_NAME(have_free_buffer, FREELIST_POLICY)
+#define GetAccessStrategy				FREELIST_POLICY_NAME(GetAccessStrategy, FREELIST_POLICY)
+#define GetAccessStrategyWithSize		FREELIST_POLICY_NAME(GetAccessStrategyWithSize, FREELIST_POLICY)
+#define GetAccessStrategyBufferCount	FREELIST_POLICY_NAME(GetAccessStrategyBufferCount, FREELIST_POLICY)
+#define FreeAccessStrategy				FREELIST_POLICY_NAME(FreeAccessStrategy, FREELIST_POLICY)
+#define IOContextForStrategy			FREELIST_POLICY_NAME(IOContextForStrategy, FREELIST_POLICY)
+#define StrategyRejectBuffer			FREELIST_POLICY_NAME(StrategyRejectBuffer, FREELIST_POLICY)
+
+/* cs3223 hooks, not every policy has all of them */
+#define StrategyAccessBuffer			FREELIST_POLICY_NAME(StrategyAccessBuffer, FREELIST_POLICY)
+#define StrategySetIncomingTag			FREELIST_POLICY_NAME(StrategySetIncomingTag, FREELIST_POLICY)
+
+#else							/* !FREELIST_POLICY */
+
+/*
+ * Declares the renamed entry points of policy; only the cs3223 hooks that
+ * the policy actually defines may be referenced.
+ */
+#define FREELIST_POLICY_DECLARE(policy) \
+	extern BufferDesc *FREELIST_POLICY_NAME(StrategyGetBuffer, policy) (BufferAccessStrategy strategy, \
+																	   uint32 *buf_state, bool *from_ring); \
+	extern void FREELIST_POLICY_NAME(StrategyFreeBuffer, policy) (BufferDesc *buf); \
+	extern int	FREELIST_POLICY_NAME(StrategySyncStart, policy) (uint32 *complete_passes, \
+																 uint32 *num_buf_alloc); \
+	extern void FREELIST_POLICY_NAME(StrategyNotifyBgWriter, policy) (int bgwprocno); \
+	extern Size FREELIST_POLICY_NAME(StrategyShmemSize, policy) (void); \
+	extern void FREELIST_POLICY_NAME(StrategyInitialize, policy) (bool init); \
+	extern bool FREELIST_POLICY_NAME(have_free_buffer, policy) (void); \
+	extern BufferAccessStrategy FREELIST_POLICY_NAME(GetAccessStrategy, policy) (BufferAccessStrategyType btype); \
+	extern BufferAccessStrategy FREELIST_POLICY_NAME(GetAccessStrategyWithSize, policy) (BufferAccessStrategyType btype, \
+																						 int ring_size_kb); \
+	extern int	FREELIST_POLICY_NAME(GetAccessStrategyBufferCount, policy) (BufferAccessStrategy strategy); \
+	extern void FREELIST_POLICY_NAME(FreeAccessStrategy, policy) (BufferAccessStrategy strategy); \
+	extern IOContext FREELIST_POLICY_NAME(IOContextForStrategy, policy) (BufferAccessStrategy strategy); \
+	extern bool FREELIST_POLICY_NAME(StrategyRejectBuffer, policy) (BufferAccessStrategy strategy, \
+																	BufferDesc *buf, bool from_ring); \
+	extern void FREELIST_POLICY_NAME(StrategyAccessBuffer, policy) (int buf_id, bool delete); \
+	extern void FREELIST_POLICY_NAME(StrategySetIncomingTag, policy) (const BufferTag *tag)
+
+#endif							/* FREELIST_POLICY */
+
+#endif							/* FREELIST_POLICY_H */
@@ -0,0 +1,1179 @@
+/*-------------------------------------------------------------------------
+ *
+ * freelist.c
+ *	  routines for managing the buffer pool's replacement strategy.
+ *
+ *
+ * Portions Copyright (c) 1996-2023, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/freelist.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+
+#define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
+
+/*
+ * S3-FIFO (Yang et al.) keeps every buffer that is in use on one of two FIFO
+ * queues, and remembers some evicted pages in a third:
+ *
+ *	small - new pages, about S3FIFO_SMALL_BUFFERS of them.
+ *	main  - pages that were accessed again while on the small queue, or
+ *			read in again while remembered on the ghost queue.
+ *	ghost - BufTableHashCode() values of pages evicted from the small queue
+ *			without being accessed again.
+ *
+ * The victim comes from the small queue while it holds its share of the
+ * buffers, from the main queue otherwise.  A page leaving the small queue
+ * that was accessed there moves to the main queue instead of being evicted,
+ * and a page leaving the main queue that was accessed is reinserted with
+ * one access less, like a clock sweep.  Most pages that are read only once
+ * thus leave through the small queue without ever reaching the main one.
+ *
+ * The access count is the buffer's usage_count, which PinBuffer() already
+ * bumps atomically on every hit: bufmgr sets it to 1 when a page is read in,
+ * so usage_count - 1 is the number of accesses since.  StrategyAccessBuffer()
+ * has nothing to do on a hit and takes no lock.
+ *
+ * As entries only ever leave a queue at its bottom and enter at its top,
+ * the queues are ring buffers of buffer ids with a pair of cursors.  A
+ * buffer that leaves its queue any other way, by being dropped or reused by
+ * a buffer ring, just gets its generation bumped, which invalidates its
+ * entry; invalid entries are skipped when they reach the bottom, and
+ * squeezed out if a queue fills up with them.  The ghost queue is a ring of
+ * hash values, with a counter per hash bucket to look them up, so a hash
+ * collision can occasionally make a new page look like a ghost hit.
+ */
+#define S3FIFO_SMALL_BUFFERS	Max(NBuffers / 10, 1)
+#define S3FIFO_GHOST_ENTRIES	Max(NBuffers - S3FIFO_SMALL_BUFFERS, 1)
+#define S3FIFO_GHOST_BUCKETS	(2 * S3FIFO_GHOST_ENTRIES)
+
+/* ring buffer capacity of the small and main queues */
+#define S3FIFO_QUEUE_SIZE		(2 * NBuffers)
+
+#define S3FIFO_QUEUE_NONE	0
+#define S3FIFO_QUEUE_SMALL	1
+#define S3FIFO_QUEUE_MAIN	2
+
+/* a queue entry is the buffer id and its generation at the time it was queued */
+#define S3FifoEntry(buf_id, gen)	(((uint64) (gen) << 32) | (uint32) (buf_id))
+#define S3FifoEntryBuffer(entry)	((int) ((entry) & 0xFFFFFFFF))
+#define S3FifoEntryGeneration(entry)	((uint32) ((entry) >> 32))
+
+typedef struct S3FifoBufferInfo
+{
+	int			queue;			/* S3FIFO_QUEUE_xxx */
+	uint32		generation;		/* bumped when the buffer leaves its queue
+								 * without its entry being consumed */
+} S3FifoBufferInfo;
+
+/* cursors of a ring buffer queue; entries from tail up to head are queued */
+typedef struct S3FifoQueue
+{
+	uint64		head;			/* next entry to fill */
+	uint64		tail;			/* oldest entry */
+	int			length;			/* number of valid entries */
+} S3FifoQueue;
+
+static S3FifoBufferInfo *s3fifoInfo = NULL;
+static uint64 *s3fifoEntries = NULL;	/* small queue, then main queue */
+static uint32 *s3fifoGhost = NULL;
+static uint32 *s3fifoGhostCounts = NULL;
+
+/*
+ * Hash of the page bufmgr is about to read in, see StrategySetIncomingTag.
+ * Backend-private.
+ */
+static uint32 s3fifoIncomingHash;
+static bool s3fifoHaveIncomingTag = false;
+
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Spinlock: protects the values below */
+	slock_t		buffer_strategy_lock;
+
+	/*
+	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
+	 * this isn't a concrete buffer - we only ever increase the value. So, to
+	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 */
+	pg_atomic_uint32 nextVictimBuffer;
+
+	int			firstFreeBuffer;	/* Head of list of unused buffers */
+	int			lastFreeBuffer; /* Tail of list of unused buffers */
+
+	/*
+	 * Spinlock: protects the queues, s3fifoInfo[] and the fields below.  It
+	 * is only taken on a miss.  When a buffer header spinlock is needed as
+	 * well, s3fifo_lock is always taken first.
+	 */
+	slock_t		s3fifo_lock;
+
+	S3FifoQueue queues[S3FIFO_QUEUE_MAIN + 1];	/* indexed by S3FIFO_QUEUE_xxx */
+	uint64		ghostHead;		/* next ghost entry to fill */
+
+	/*
+	 * NOTE: lastFreeBuffer is undefined when firstFreeBuffer is -1 (that is,
+	 * when the list is empty)
+	 */
+
+	/*
+	 * Statistics.  These counters should be wide enough that they can't
+	 * overflow during a single bgwriter cycle.
+	 */
+	uint32		completePasses; /* Complete cycles of the clock sweep */
+	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+
+	/*
+	 * Bgworker process to be notified upon activity or -1 if none. See
+	 * StrategyNotifyBgWriter.
+	 */
+	int			bgwprocno;
+} BufferStrategyControl;
+
+/* Pointers to shared state */
+static BufferStrategyControl *StrategyControl = NULL;
+
+/*
+ * Private (non-shared) state for managing a ring of shared buffers to re-use.
+ * This is currently the only kind of BufferAccessStrategy object, but someday
+ * we might have more kinds.
+ */
+typedef struct BufferAccessStrategyData
+{
+	/* Overall strategy type */
+	BufferAccessStrategyType btype;
+	/* Number of elements in buffers[] array */
+	int			nbuffers;
+
+	/*
+	 * Index of the "current" slot in the ring, ie, the one most recently
+	 * returned by GetBufferFromRing.
+	 */
+	int			current;
+
+	/*
+	 * Array of buffer numbers.  InvalidBuffer (that is, zero) indicates we
+	 * have not yet selected a buffer for this ring slot.  For allocation
+	 * simplicity this is palloc'd together with the fixed fields of the
+	 * struct.
+	 */
+	Buffer		buffers[FLEXIBLE_ARRAY_MEMBER];
+}			BufferAccessStrategyData;
+
+
+void StrategyAccessBuffer(int buf_id, bool delete); /* cs3223 */
+void StrategySetIncomingTag(const BufferTag *tag); /* cs3223 */
+
+/* Prototypes for internal functions */
+static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
+									 uint32 *buf_state);
+static void AddBufferToRing(BufferAccessStrategy strategy,
+							BufferDesc *buf);
+
+/*
+ * ClockSweepTick - Helper routine for StrategyGetBuffer()
+ *
+ * Move the clock hand one buffer ahead of its current position and return the
+ * id of the buffer now under the hand.
+ */
+static inline uint32
+ClockSweepTick(void)
+{
+	uint32		victim;
+
+	/*
+	 * Atomically move hand ahead one buffer - if there's several processes
+	 * doing this, this can lead to buffers being returned slightly out of
+	 * apparent order.
+	 */
+	victim =
+		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+
+	if (victim >= NBuffers)
+	{
+		uint32		originalVictim = victim;
+
+		/* always wrap what we look up in BufferDescriptors */
+		victim = victim % NBuffers;
+
+		/*
+		 * If we're the one that just caused a wraparound, force
+		 * completePasses to be incremented while holding the spinlock. We
+		 * need the spinlock so StrategySyncStart() can return a consistent
+		 * value consisting of nextVictimBuffer and completePasses.
+		 */
+		if (victim == 0)
+		{
+			uint32		expected;
+			uint32		wrapped;
+			bool		success = false;
+
+			expected = originalVictim + 1;
+
+			while (!success)
+			{
+				/*
+				 * Acquire the spinlock while increasing completePasses. That
+				 * allows other readers to read nextVictimBuffer and
+				 * completePasses in a consistent manner which is required for
+				 * StrategySyncStart().  In theory delaying the increment
+				 * could lead to an overflow of nextVictimBuffers, but that's
+				 * highly unlikely and wouldn't be particularly harmful.
+				 */
+				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+				wrapped = expected % NBuffers;
+
+				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+														 &expected, wrapped);
+				if (success)
+					StrategyControl->completePasses++;
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+			}
+		}
+	}
+	return victim;
+}
+
+/*
+ * have_free_buffer -- a lockless check to see if there is a free buffer in
+ *					   buffer pool.
+ *
+ * If the result is true that will become stale once free buffers are moved out
+ * by other operations, so the caller who strictly want to use a free buffer
+ * should not call this.
+ */
+bool
+have_free_buffer(void)
+{
+	if (StrategyControl->firstFreeBuffer >= 0)
+		return true;
+	else
+		return false;
+}
+
+
+static inline uint64 *
+S3FifoQueueEntries(int queue)
+{
+	return &s3fifoEntries[(queue - 1) * (Size) S3FIFO_QUEUE_SIZE];
+}
+
+static inline bool
+S3FifoEntryIsValid(int queue, uint64 entry)
+{
+	S3FifoBufferInfo *info = &s3fifoInfo[S3FifoEntryBuffer(entry)];
+
+	return info->queue == queue &&
+		info->generation == S3FifoEntryGeneration(entry);
+}
+
+/*
+ * S3FifoCompact -- squeeze the invalid entries out of a full queue.  There
+ * are at most NBuffers valid ones, so this frees half of the queue at least.
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static void
+S3FifoCompact(int queue)
+{
+	S3FifoQueue *q = &StrategyControl->queues[queue];
+	uint64	   *entries = S3FifoQueueEntries(queue);
+	uint64		to = q->tail;
+
+	for (uint64 from = q->tail; from < q->head; from++)
+	{
+		uint64		entry = entries[from % S3FIFO_QUEUE_SIZE];
+
+		if (S3FifoEntryIsValid(queue, entry))
+			entries[to++ % S3FIFO_QUEUE_SIZE] = entry;
+	}
+	q->head = to;
+}
+
+/*
+ * S3FifoPush -- put buffer at the top of queue.
+ *
+ * Caller must hold s3fifo_lock, and the buffer must not be on any queue.
+ */
+static void
+S3FifoPush(int queue, int buf_id)
+{
+	S3FifoQueue *q = &StrategyControl->queues[queue];
+
+	Assert(s3fifoInfo[buf_id].queue == S3FIFO_QUEUE_NONE);
+
+	if (q->head - q->tail == S3FIFO_QUEUE_SIZE)
+		S3FifoCompact(queue);
+
+	S3FifoQueueEntries(queue)[q->head++ % S3FIFO_QUEUE_SIZE] =
+		S3FifoEntry(buf_id, s3fifoInfo[buf_id].generation);
+	s3fifoInfo[buf_id].queue = queue;
+	q->length++;
+}
+
+/*
+ * S3FifoPop -- take the bottom-most valid entry off queue, and return its
+ *		buffer, or -1 if the queue is empty.
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static int
+S3FifoPop(int queue)
+{
+	S3FifoQueue *q = &StrategyControl->queues[queue];
+	uint64	   *entries = S3FifoQueueEntries(queue);
+
+	while (q->tail < q->head)
+	{
+		uint64		entry = entries[q->tail++ % S3FIFO_QUEUE_SIZE];
+
+		if (S3FifoEntryIsValid(queue, entry))
+		{
+			s3fifoInfo[S3FifoEntryBuffer(entry)].queue = S3FIFO_QUEUE_NONE;
+			q->length--;
+			return S3FifoEntryBuffer(entry);
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * S3FifoUnlink -- take buffer off its queue, if any, by invalidating its
+ *		entry.  Returns the queue it was on.
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static int
+S3FifoUnlink(int buf_id)
+{
+	S3FifoBufferInfo *info = &s3fifoInfo[buf_id];
+	int			queue = info->queue;
+
+	if (queue != S3FIFO_QUEUE_NONE)
+	{
+		StrategyControl->queues[queue].length--;
+		info->queue = S3FIFO_QUEUE_NONE;
+		info->generation++;
+	}
+
+	return queue;
+}
+
+/*
+ * S3FifoGhostContains -- is a page with this hash on the ghost queue?
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static inline bool
+S3FifoGhostContains(uint32 hash)
+{
+	return s3fifoGhostCounts[hash % S3FIFO_GHOST_BUCKETS] > 0;
+}
+
+/*
+ * S3FifoGhostRemember -- put a page hash at the top of the ghost queue,
+ *		forgetting the oldest one once the queue is full.
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static void
+S3FifoGhostRemember(uint32 hash)
+{
+	uint64		pos = StrategyControl->ghostHead++ % S3FIFO_GHOST_ENTRIES;
+
+	if (StrategyControl->ghostHead > S3FIFO_GHOST_ENTRIES)
+		s3fifoGhostCounts[s3fifoGhost[pos] % S3FIFO_GHOST_BUCKETS]--;
+
+	s3fifoGhost[pos] = hash;
+	s3fifoGhostCounts[hash % S3FIFO_GHOST_BUCKETS]++;
+}
+
+/*
+ * S3FifoLoadBuffer -- note that buffer is about to be (re)loaded with the
+ *		incoming page.
+ *
+ * from_queue is the queue the buffer was just taken off by the caller, if
+ * any.  A page leaving the small queue is remembered on the ghost queue.
+ * The buffer then goes to the top of the main queue if the incoming page is
+ * on the ghost queue, to the top of the small queue otherwise.  The caller
+ * holds the buffer header spinlock, so buf->tag and buf_state still describe
+ * the previous page.
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static void
+S3FifoLoadBuffer(BufferDesc *buf, uint32 buf_state, int from_queue)
+{
+	bool		ghost_hit;
+
+	// look the incoming page up first, remembering the old page may push it out
+	ghost_hit = s3fifoHaveIncomingTag && S3FifoGhostContains(s3fifoIncomingHash);
+
+	// a buffer reused by a buffer ring is still queued
+	if (from_queue == S3FIFO_QUEUE_NONE)
+		from_queue = S3FifoUnlink(buf->buf_id);
+
+	if (from_queue == S3FIFO_QUEUE_SMALL && (buf_state & BM_TAG_VALID))
+		S3FifoGhostRemember(BufTableHashCode(&buf->tag));
+
+	S3FifoPush(ghost_hit ? S3FIFO_QUEUE_MAIN : S3FIFO_QUEUE_SMALL, buf->buf_id);
+}
+
+/*
+ * S3FifoGetVictim -- run the queues until an unaccessed, unpinned buffer
+ *		reaches the bottom of the queue being evicted from, and return it
+ *		with its header spinlock held.  *from_queue is set to that queue.
+ *		Returns NULL if every buffer is pinned.
+ *
+ * Pinned buffers go back to the top of their queue.  If all buffers on the
+ * queue to evict from turn out to be pinned, the other queue is run instead.
+ * As in the original clock sweep, we give up after NBuffers pinned buffers
+ * in a row.
+ *
+ * Caller must hold s3fifo_lock.
+ */
+static BufferDesc *
+S3FifoGetVictim(uint32 *buf_state, int *from_queue)
+{
+	int			trycounter = NBuffers;
+	int			pinnedInRow[S3FIFO_QUEUE_MAIN + 1] = {0};
+
+	for (;;)
+	{
+		S3FifoQueue *small = &StrategyControl->queues[S3FIFO_QUEUE_SMALL];
+		int			queue = S3FIFO_QUEUE_MAIN;
+		int			buf_id;
+		BufferDesc *buf;
+		uint32		local_buf_state;
+
+		if (small->length > 0 &&
+			(small->length >= S3FIFO_SMALL_BUFFERS ||
+			 StrategyControl->queues[S3FIFO_QUEUE_MAIN].length == 0))
+			queue = S3FIFO_QUEUE_SMALL;
+
+		if (pinnedInRow[queue] >= StrategyControl->queues[queue].length)
+			queue = (queue == S3FIFO_QUEUE_SMALL) ? S3FIFO_QUEUE_MAIN : S3FIFO_QUEUE_SMALL;
+
+		buf_id = S3FifoPop(queue);
+		if (buf_id < 0)
+			return NULL;		/* both queues are empty */
+
+		buf = GetBufferDescriptor(buf_id);
+		local_buf_state = LockBufHdr(buf);
+
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) != 0)
+		{
+			UnlockBufHdr(buf, local_buf_state);
+			S3FifoPush(queue, buf_id);
+			pinnedInRow[queue]++;
+			if (--trycounter == 0)
+				return NULL;
+			continue;
+		}
+
+		if (BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+		{
+			*from_queue = queue;
+			*buf_state = local_buf_state;
+			return buf;
+		}
+
+		if (queue == S3FIFO_QUEUE_SMALL)
+		{
+			// accessed again while on the small queue: move to the main queue
+			local_buf_state &= ~BUF_USAGECOUNT_MASK;
+			local_buf_state += BUF_USAGECOUNT_ONE;
+			UnlockBufHdr(buf, local_buf_state);
+			S3FifoPush(S3FIFO_QUEUE_MAIN, buf_id);
+		}
+		else
+		{
+			// accessed while on the main queue: reinsert with one access less
+			local_buf_state -= BUF_USAGECOUNT_ONE;
+			UnlockBufHdr(buf, local_buf_state);
+			S3FifoPush(S3FIFO_QUEUE_MAIN, buf_id);
+		}
+		pinnedInRow[S3FIFO_QUEUE_SMALL] = 0;
+		pinnedInRow[S3FIFO_QUEUE_MAIN] = 0;
+		trycounter = NBuffers;
+	}
+}
+
+// cs3223
+// StrategySetIncomingTag
+// Called by bufmgr right before every StrategyGetBuffer call with the tag of the page the
+// buffer is for (NULL when extending a relation), and with NULL once the call returns.
+// The hash of the tag is looked up in the ghost queue.
+void
+StrategySetIncomingTag(const BufferTag *tag)
+{
+	s3fifoHaveIncomingTag = (tag != NULL);
+	if (tag != NULL)
+		s3fifoIncomingHash = BufTableHashCode((BufferTag *) tag);
+}
+
+// cs3223
+// StrategyAccessBuffer 
+// Called by bufmgr when a buffer page is accessed.
+// Does nothing if delete is false, as PinBuffer has already counted the access (usage_count);
+// otherwise, delete buffer buf_id from its S3-FIFO queue.  A dropped page is not remembered on the ghost queue.
+void
+StrategyAccessBuffer(int buf_id, bool delete)
+{
+	if (buf_id < 0 || buf_id >= NBuffers) // check the range of buf_id
+		elog(ERROR, "Invalid buffer index");
+
+	if (!delete)
+		return;
+
+	SpinLockAcquire(&StrategyControl->s3fifo_lock);
+	S3FifoUnlink(buf_id);
+	SpinLockRelease(&StrategyControl->s3fifo_lock);
+}
+
+/*
+ * StrategyGetBuffer
+ *
+ *	Called by the bufmgr to get the next candidate buffer to use in
+ *	BufferAlloc(). The only hard requirement BufferAlloc() has is that
+ *	the selected buffer must not currently be pinned by anyone.
+ *
+ *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
+ *
+ *	To ensure that no one else can pin the buffer before we do, we must
+ *	return the buffer with the buffer header spinlock still held.
+ */
+BufferDesc *
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool *from_ring)
+{
+	BufferDesc *buf;
+	int			bgwprocno;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+	*from_ring = false;
+
+	/*
+	 * If given a strategy object, see whether it can select a buffer. We
+	 * assume strategy objects don't need buffer_strategy_lock.  s3fifo_lock is
+	 * taken before GetBufferFromRing locks the buffer header, so that the
+	 * reused buffer can be requeued while it is still locked.
+	 */
+	if (strategy != NULL)
+	{
+		SpinLockAcquire(&StrategyControl->s3fifo_lock);
+		buf = GetBufferFromRing(strategy, buf_state);
+		if (buf != NULL)
+		{
+			*from_ring = true;
+			S3FifoLoadBuffer(buf, *buf_state, S3FIFO_QUEUE_NONE);
+			SpinLockRelease(&StrategyControl->s3fifo_lock);
+			return buf;
+		}
+		SpinLockRelease(&StrategyControl->s3fifo_lock);
+	}
+
+	/*
+	 * If asked, we need to waken the bgwriter. Since we don't want to rely on
+	 * a spinlock for this we force a read from shared memory once, and then
+	 * set the latch based on that value. We need to go through that length
+	 * because otherwise bgwprocno might be reset while/after we check because
+	 * the compiler might just reread from memory.
+	 *
+	 * This can possibly set the latch of the wrong process if the bgwriter
+	 * dies in the wrong moment. But since PGPROC->procLatch is never
+	 * deallocated the worst consequence of that is that we set the latch of
+	 * some arbitrary process.
+	 */
+	bgwprocno = INT_ACCESS_ONCE(StrategyControl->bgwprocno);
+	if (bgwprocno != -1)
+	{
+		/* reset bgwprocno first, before setting the latch */
+		StrategyControl->bgwprocno = -1;
+
+		/*
+		 * Not acquiring ProcArrayLock here which is slightly icky. It's
+		 * actually fine because procLatch isn't ever freed, so we just can
+		 * potentially set the wrong process' (or no process') latch.
+		 */
+		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
+	}
+
+	/*
+	 * We count buffer allocation requests so that the bgwriter can estimate
+	 * the rate of buffer consumption.  Note that buffers recycled by a
+	 * strategy object are intentionally not counted here.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+
+	/*
+	 * First check, without acquiring the lock, whether there's buffers in the
+	 * freelist. Since we otherwise don't require the spinlock in every
+	 * StrategyGetBuffer() invocation, it'd be sad to acquire it here -
+	 * uselessly in most cases. That obviously leaves a race where a buffer is
+	 * put on the freelist but we don't see the store yet - but that's pretty
+	 * harmless, it'll just get used during the next buffer acquisition.
+	 *
+	 * If there's buffers on the freelist, acquire the spinlock to pop one
+	 * buffer of the freelist. Then check whether that buffer is usable and
+	 * repeat if not.
+	 *
+	 * Note that the freeNext fields are considered to be protected by the
+	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * manipulate them without holding the spinlock.
+	 */
+	if (StrategyControl->firstFreeBuffer >= 0)
+	{
+		while (true)
+		{
+			/* Acquire the spinlock to remove element from the freelist */
+			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+			if (StrategyControl->firstFreeBuffer < 0)
+			{
+				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+				break;
+			}
+
+			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
+			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
+
+			/* Unconditionally remove buffer from freelist */
+			StrategyControl->firstFreeBuffer = buf->freeNext;
+			buf->freeNext = FREENEXT_NOT_IN_LIST;
+
+			/*
+			 * Release the lock so someone else can access the freelist while
+			 * we check out this buffer.
+			 */
+			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+
+			/*
+			 * If the buffer is pinned, we cannot use it; discard it and
+			 * retry.  (This can only happen if VACUUM put a valid buffer in
+			 * the freelist and then someone else used it before we got to
+			 * it.  It's probably impossible altogether as of 8.3, but we'd
+			 * better check anyway.)
+			 *
+			 * For s3fifo implementation, usage_count is the access count and
+			 * does not matter for a free buffer.
+			 */
+			SpinLockAcquire(&StrategyControl->s3fifo_lock);
+			local_buf_state = LockBufHdr(buf);
+			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+			{
+				if (strategy != NULL)
+					AddBufferToRing(strategy, buf);
+				S3FifoLoadBuffer(buf, local_buf_state, S3FIFO_QUEUE_NONE);
+				SpinLockRelease(&StrategyControl->s3fifo_lock);
+				*buf_state = local_buf_state;
+				return buf;
+			}
+			UnlockBufHdr(buf, local_buf_state);
+			SpinLockRelease(&StrategyControl->s3fifo_lock);
+		}
+	}
+
+	/*
+	 * Nothing on the freelist, so run S3-FIFO: evict from the small queue
+	 * while it holds its share of the buffers, from the main queue otherwise.
+	 */
+	SpinLockAcquire(&StrategyControl->s3fifo_lock);
+	{
+		int			from_queue;
+
+		buf = S3FifoGetVictim(buf_state, &from_queue);
+		if (buf == NULL)
+		{
+			SpinLockRelease(&StrategyControl->s3fifo_lock);
+			elog(ERROR, "no unpinned buffers available");
+		}
+
+		if (strategy != NULL)
+			AddBufferToRing(strategy, buf);
+		S3FifoLoadBuffer(buf, *buf_state, from_queue);
+	}
+	SpinLockRelease(&StrategyControl->s3fifo_lock);
+	return buf;
+}
+
+/*
+ * StrategyFreeBuffer: put a buffer on the freelist
+ */
+void
+StrategyFreeBuffer(BufferDesc *buf)
+{
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+
+	/*
+	 * It is possible that we are told to put something in the freelist that
+	 * is already in it; don't screw up the list if so.
+	 */
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	{
+		buf->freeNext = StrategyControl->firstFreeBuffer;
+		if (buf->freeNext < 0)
+			StrategyControl->lastFreeBuffer = buf->buf_id;
+		StrategyControl->firstFreeBuffer = buf->buf_id;
+		// Buffer is returned to freelist, so it leaves its S3-FIFO queue
+		StrategyAccessBuffer(buf->buf_id, true);
+	}
+
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+/*
+ * StrategySyncStart -- tell BufferSync where to start syncing
+ *
+ * The result is the buffer index of the best buffer to sync first.
+ * BufferSync() will proceed circularly around the buffer array from there.
+ *
+ * In addition, we return the completed-pass count (which is effectively
+ * the higher-order bits of nextVictimBuffer) and the count of recent buffer
+ * allocs if non-NULL pointers are passed.  The alloc count is reset after
+ * being read.
+ */
+int
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+{
+	uint32		nextVictimBuffer;
+	int			result;
+
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
+	result = nextVictimBuffer % NBuffers;
+
+	if (complete_passes)
+	{
+		*complete_passes = StrategyControl->completePasses;
+
+		/*
+		 * Additionally add the number of wraparounds that happened before
+		 * completePasses could be incremented. C.f. ClockSweepTick().
+		 */
+		*complete_passes += nextVictimBuffer / NBuffers;
+	}
+
+	if (num_buf_alloc)
+	{
+		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
+	}
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	return result;
+}
+
+/*
+ * StrategyNotifyBgWriter -- set or clear allocation notification latch
+ *
+ * If bgwprocno isn't -1, the next invocation of StrategyGetBuffer will
+ * set that latch.  Pass -1 to clear the pending notification before it
+ * happens.  This feature is used by the bgwriter process to wake itself up
+ * from hibernation, and is not meant for anybody else to use.
+ */
+void
+StrategyNotifyBgWriter(int bgwprocno)
+{
+	/*
+	 * We acquire buffer_strategy_lock just to ensure that the store appears
+	 * atomic to StrategyGetBuffer.  The bgwriter should call this rather
+	 * infrequently, so there's no performance penalty from being safe.
+	 */
+	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	StrategyControl->bgwprocno = bgwprocno;
+	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+}
+
+
+/*
+ * StrategyShmemSize
+ *
+ * estimate the size of shared memory used by the freelist-related structures.
+ *
+ * Note: for somewhat historical reasons, the buffer lookup hashtable size
+ * is also determined here.
+ */
+Size
+StrategyShmemSize(void)
+{
+	Size		size = 0;
+
+	/* size of lookup hash table ... see comment in StrategyInitialize */
+	size = add_size(size, BufTableShmemSize(NBuffers + NUM_BUFFER_PARTITIONS));
+
+	/* size of the shared replacement strategy control block */
+	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
+
+	/* size of the per-buffer queue membership and of the two queues */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(S3FifoBufferInfo), NBuffers)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(uint64), mul_size(2, S3FIFO_QUEUE_SIZE))));
+
+	/* size of the ghost queue and its hash bucket counters */
+	size = add_size(size, MAXALIGN(mul_size(sizeof(uint32), S3FIFO_GHOST_ENTRIES)));
+	size = add_size(size, MAXALIGN(mul_size(sizeof(uint32), S3FIFO_GHOST_BUCKETS)));
+
+	return size;
+}
+
+/*
+ * StrategyInitialize -- initialize the buffer cache replacement
+ *		strategy.
+ *
+ * Assumes: All of the buffers are already built into a linked list.
+ *		Only called by postmaster and only during initialization.
+ */
+void
+StrategyInitialize(bool init)
+{
+	bool		found;
+	bool		s3fifo_found;
+
+	/*
+	 * Initialize the shared buffer lookup hashtable.
+	 *
+	 * Since we can't tolerate running out of lookup table entries, we must be
+	 * sure to specify an adequate table size here.  The maximum steady-state
+	 * usage is of course NBuffers entries, but BufferAlloc() tries to insert
+	 * a new entry before deleting the old.  In principle this could be
+	 * happening in each partition concurrently, so we could need as many as
+	 * NBuffers + NUM_BUFFER_PARTITIONS entries.
+	 */
+	InitBufTable(NBuffers + NUM_BUFFER_PARTITIONS);
+
+	/*
+	 * Get or create the shared strategy control block
+	 */
+	StrategyControl = (BufferStrategyControl *)
+		ShmemInitStruct("Buffer Strategy Status",
+						sizeof(BufferStrategyControl),
+						&found);
+
+	if (!found)
+	{
+		/*
+		 * Only done once, usually in postmaster
+		 */
+		Assert(init);
+
+		SpinLockInit(&StrategyControl->buffer_strategy_lock);
+
+		/*
+		 * Grab the whole linked list of free buffers for our strategy. We
+		 * assume it was previously set up by InitBufferPool().
+		 */
+		StrategyControl->firstFreeBuffer = 0;
+		StrategyControl->lastFreeBuffer = NBuffers - 1;
+
+		SpinLockInit(&StrategyControl->s3fifo_lock);
+		memset(StrategyControl->queues, 0, sizeof(StrategyControl->queues));
+		StrategyControl->ghostHead = 0;
+
+		/* Initialize the clock sweep pointer */
+		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+
+		/* Clear statistics */
+		StrategyControl->completePasses = 0;
+		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+
+		/* No pending notification */
+		StrategyControl->bgwprocno = -1;
+	}
+	else
+		Assert(!init);
+
+	/* Get or create the S3-FIFO queues, all of them start empty */
+	s3fifoInfo = (S3FifoBufferInfo *)
+		ShmemInitStruct("S3-FIFO buffer queues",
+						MAXALIGN(mul_size(sizeof(S3FifoBufferInfo), NBuffers)),
+						&s3fifo_found);
+	s3fifoEntries = (uint64 *)
+		ShmemInitStruct("S3-FIFO queue entries",
+						MAXALIGN(mul_size(sizeof(uint64), mul_size(2, S3FIFO_QUEUE_SIZE))),
+						&s3fifo_found);
+	s3fifoGhost = (uint32 *)
+		ShmemInitStruct("S3-FIFO ghost queue",
+						MAXALIGN(mul_size(sizeof(uint32), S3FIFO_GHOST_ENTRIES)),
+						&s3fifo_found);
+	s3fifoGhostCounts = (uint32 *)
+		ShmemInitStruct("S3-FIFO ghost counts",
+						MAXALIGN(mul_size(sizeof(uint32), S3FIFO_GHOST_BUCKETS)),
+						&s3fifo_found);
+
+	if (!s3fifo_found)
+	{
+		Assert(init);
+
+		for (int i = 0; i < NBuffers; i++)
+		{
+			s3fifoInfo[i].queue = S3FIFO_QUEUE_NONE;
+			s3fifoInfo[i].generation = 0;
+		}
+
+		memset(s3fifoGhostCounts, 0, mul_size(sizeof(uint32), S3FIFO_GHOST_BUCKETS));
+	}
+	else
+		Assert(!init);
+}
+
+
+/* ----------------------------------------------------------------
+ *				Backend-private buffer ring management
+ * ----------------------------------------------------------------
+ */
+
+
+/*
+ * GetAccessStrategy -- create a BufferAccessStrategy object
+ *
+ * The object is allocated in the current memory context.
+ */
+BufferAccessStrategy
+GetAccessStrategy(BufferAccessStrategyType btype)
+{
+	int			ring_size_kb;
+
+	/*
+	 * Select ring size to use.  See buffer/README for rationales.
+	 *
+	 * Note: if you change the ring size for BAS_BULKREAD, see also
+	 * SYNC_SCAN_REPORT_INTERVAL in access/heap/syncscan.c.
+	 */
+	switch (btype)
+	{
+		case BAS_NORMAL:
+			/* if someone asks for NORMAL, just give 'em a "default" object */
+			return NULL;
+
+		case BAS_BULKREAD:
+			ring_size_kb = 256;
+			break;
+		case BAS_BULKWRITE:
+			ring_size_kb = 16 * 1024;
+			break;
+		case BAS_VACUUM:
+			ring_size_kb = 256;
+			break;
+
+		default:
+			elog(ERROR, "unrecognized buffer access strategy: %d",
+				 (int) btype);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	return GetAccessStrategyWithSize(btype, ring_size_kb);
+}
+
+/*
+ * GetAccessStrategyWithSize -- create a BufferAccessStrategy object with a
+ *		number of buffers equivalent to the passed in size.
+ *
+ * If the given ring size is 0, no BufferAccessStrategy will be created and
+ * the function will return NULL.  ring_size_kb must not be negative.
+ */
+BufferAccessStrategy
+GetAccessStrategyWithSize(BufferAccessStrategyType btype, int ring_size_kb)
+{
+	int			ring_buffers;
+	BufferAccessStrategy strategy;
+
+	Assert(ring_size_kb >= 0);
+
+	/* Figure out how many buffers ring_size_kb is */
+	ring_buffers = ring_size_kb / (BLCKSZ / 1024);
+
+	/* 0 means unlimited, so no BufferAccessStrategy required */
+	if (ring_buffers == 0)
+		return NULL;
+
+	/* Cap to 1/8th of shared_buffers */
+	ring_buffers = Min(NBuffers / 8, ring_buffers);
+
+	/* NBuffers should never be less than 16, so this shouldn't happen */
+	Assert(ring_buffers > 0);
+
+	/* Allocate the object and initialize all elements to zeroes */
+	strategy = (BufferAccessStrategy)
+		palloc0(offsetof(BufferAccessStrategyData, buffers) +
+				ring_buffers * sizeof(Buffer));
+
+	/* Set fields that don't start out zero */
+	strategy->btype = btype;
+	strategy->nbuffers = ring_buffers;
+
+	return strategy;
+}
+
+/*
+ * GetAccessStrategyBufferCount -- an accessor for the number of buffers in
+ *		the ring
+ *
+ * Returns 0 on NULL input to match behavior of GetAccessStrategyWithSize()
+ * returning NULL with 0 size.
+ */
+int
+GetAccessStrategyBufferCount(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return 0;
+
+	return strategy->nbuffers;
+}
+
+/*
+ * FreeAccessStrategy -- release a BufferAccessStrategy object
+ *
+ * A simple pfree would do at the moment, but we would prefer that callers
+ * don't assume that much about the representation of BufferAccessStrategy.
+ */
+void
+FreeAccessStrategy(BufferAccessStrategy strategy)
+{
+	/* don't crash if called on a "default" strategy */
+	if (strategy != NULL)
+		pfree(strategy);
+}
+
+/*
+ * GetBufferFromRing -- returns a buffer from the ring, or NULL if the
+ *		ring is empty / not usable.
+ *
+ * The bufhdr spin lock is held on the returned buffer.
+ */
+static BufferDesc *
+GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	Buffer		bufnum;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+
+
+	/* Advance to next ring slot */
+	if (++strategy->current >= strategy->nbuffers)
+		strategy->current = 0;
+
+	/*
+	 * If the slot hasn't been filled yet, tell the caller to allocate a new
+	 * buffer with the normal allocation strategy.  He will then fill this
+	 * slot by calling AddBufferToRing with the new buffer.
+	 */
+	bufnum = strategy->buffers[strategy->current];
+	if (bufnum == InvalidBuffer)
+		return NULL;
+
+	/*
+	 * If the buffer is pinned we cannot use it under any circumstances.
+	 *
+	 * If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+	 * since our own previous usage of the ring element would have left it
+	 * there, but it might've been decremented by clock sweep since then). A
+	 * higher usage_count indicates someone else has touched the buffer, so we
+	 * shouldn't re-use it.
+	 */
+	buf = GetBufferDescriptor(bufnum - 1);
+	local_buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+	{
+		*buf_state = local_buf_state;
+		return buf;
+	}
+	UnlockBufHdr(buf, local_buf_state);
+
+	/*
+	 * Tell caller to allocate a new buffer with the normal allocation
+	 * strategy.  He'll then replace this ring element via AddBufferToRing.
+	 */
+	return NULL;
+}
+
+/*
+ * AddBufferToRing -- add a buffer to the buffer ring
+ *
+ * Caller must hold the buffer header spinlock on the buffer.  Since this
+ * is called with the spinlock held, it had better be quite cheap.
+ */
+static void
+AddBufferToRing(BufferAccessStrategy strategy, BufferDesc *buf)
+{
+	strategy->buffers[strategy->current] = BufferDescriptorGetBuffer(buf);
+}
+
+/*
+ * Utility function returning the IOContext of a given BufferAccessStrategy's
+ * strategy ring.
+ */
+IOContext
+IOContextForStrategy(BufferAccessStrategy strategy)
+{
+	if (!strategy)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_NORMAL:
+
+			/*
+			 * Currently, GetAccessStrategy() returns NULL for
+			 * BufferAccessStrategyType BAS_NORMAL, so this case is
+			 * unreachable.
+			 */
+			pg_unreachable();
+			return IOCONTEXT_NORMAL;
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+	}
+
+	elog(ERROR, "unrecognized BufferAccessStrategyType: %d", strategy->btype);
+	pg_unreachable();
+}
+
+/*
+ * StrategyRejectBuffer -- consider rejecting a dirty buffer
+ *
+ * When a nondefault strategy is used, the buffer manager calls this function
+ * when it turns out that the buffer selected by StrategyGetBuffer needs to
+ * be written out and doing so would require flushing WAL too.  This gives us
+ * a chance to choose a different victim.
+ *
+ * Returns true if buffer manager should ask for a new victim, and false
+ * if this buffer should be written and re-used.
+ */
+bool
+StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf, bool from_ring)
+{
+	/* We only do this in bulkread mode */
+	if (strategy->btype != BAS_BULKREAD)
+		return false;
+
+	/* Don't muck with behavior of normal buffer-replacement strategy */
+	if (!from_ring ||
+		strategy->buffers[strategy->current] != BufferDescriptorGetBuffer(buf))
+		return false;
+
+	/*
+	 * Remove the dirty buffer from the ring; necessary to prevent infinite
+	 * loop if all ring members are dirty.
+	 */
+	strategy->buffers[strategy->current] = InvalidBuffer;
+
+	return true;
+}
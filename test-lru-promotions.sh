@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+
+# Script for checking that the LRU policy applies buffer hits to the LRU stack
+# with a buffer pool large enough for its hot buffer filter (1024 pages or more)
+
+# IMPORTANT: You must edit the value of PGPORT variable in settings.sh before running this script
+
+policy=lru
+
+source ./settings.sh
+
+pg_ctl stop
+
+pg_ctl start -l ${LOG_FILE} -o "-p ${PGPORT} -B 1024 -c log_min_messages=debug1"
+
+# check that server is running
+if ! pg_ctl status > /dev/null; then
+	echo "ERROR: postgres server is not running!"
+	exit 1;
+fi
+
+
+# if database exists, drop database
+if psql -l | grep -q "${DBNAME}"; then
+	echo "Dropping database ${DBNAME} ..."
+	dropdb "${DBNAME}"
+fi
+
+echo "Creating database ${DBNAME} ..."
+createdb "${DBNAME}"
+
+
+# check that number of shared buffer pages is configured to 1024 pages
+if ! psql -c "SHOW shared_buffers;" ${DBNAME} | grep -q "8MB" ; then
+	echo "ERROR: restart server with 1024 buffer pages!"
+	exit 1;
+fi
+
+
+# create benchmark database relations, larger than the buffer pool
+SCALE_FACTOR=4
+pgbench -i -s ${SCALE_FACTOR} --unlogged-tables ${DBNAME}
+
+
+# run a short read-only benchmark; backends log the promotion counts of the
+# LRU stack at DEBUG1 every few thousand flushes of their buffer hits
+LOG_START=$(wc -l < ${LOG_FILE})
+
+pgbench -S -c 4 -j 4 -T 30 ${DBNAME}
+
+applied=$(tail -n +$((LOG_START + 1)) ${LOG_FILE} | \
+	sed -n 's/.*LRU promotions applied: \([0-9]*\),.*/\1/p' | tail -n 1)
+
+if [ -z "${applied}" ]; then
+	echo "ERROR: no LRU promotion counts in ${LOG_FILE}!"
+	exit 1;
+fi
+
+if [ "${applied}" -eq 0 ]; then
+	echo "FAIL: ${policy} applied no buffer hits to the LRU stack"
+	exit 1;
+fi
+
+echo "PASS: ${policy} applied ${applied} buffer hits to the LRU stack"